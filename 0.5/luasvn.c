@@ -11,7 +11,16 @@
 #include <svn_props.h>
 #include <svn_time.h>
 #include <svn_compat.h>
+#include <svn_ra.h>
+#include <svn_delta.h>
+#include <svn_sorts.h>
 #include <apr_xlate.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#include <apr_atomic.h>
+#include <apr_md5.h>
+#include <apr_mmap.h>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -48,15 +57,22 @@ send_error (lua_State *L, const char *message) {
 }
 
 
+/* Set once the libraries are initialized for the process */
+static int initialized = 0;
+
+/* Lives as long as the process, used by the RA layer */
+static apr_pool_t *global_pool = NULL;
+
+/* Serializes the log cache saves of the threads of the process; the
+   file lock only keeps processes apart */
+static apr_thread_mutex_t *log_cache_mutex = NULL;
+
+
 /* Initializes the memory pool */
 static int
 init_pool (apr_pool_t **pool) {
-	if (apr_initialize () != APR_SUCCESS) {
-		return 1;
-	}
-	svn_dso_initialize2();
-    *pool = svn_pool_create (NULL);
-	return 0;
+	*pool = svn_pool_create (NULL);
+	return *pool == NULL;
 }
 
 
@@ -67,1645 +83,7099 @@ init_pool_error (lua_State *L) {
 }
 
 
-static int
-init_function (svn_client_ctx_t **ctx, apr_pool_t **pool, lua_State *L) {
+/* Options used to build a client context */
+typedef struct luasvn_client_opts {
+	const char *config_dir;
+	const char *username;
+	const char *password;
+	svn_boolean_t non_interactive;
+	svn_boolean_t no_auth_cache;
+	svn_boolean_t trust_server_cert;
+} luasvn_client_opts;
+
+
+/* An RA session kept open by a client between calls */
+typedef struct ra_session_entry {
+	apr_pool_t *pool;
+	svn_ra_session_t *session;
+	const char *root;           /* repository root URL of the session */
+	const char *uuid;           /* of the repository, once asked */
+	apr_time_t last_used;
+	svn_boolean_t in_use;
+	struct ra_session_entry *next;
+} ra_session_entry;
+
+
+/* The contents of a file in the cat cache, in one malloc'd block with
+   its key */
+typedef struct cat_cache_entry {
+	struct cat_cache_entry *prev;   /* used more recently */
+	struct cat_cache_entry *next;
+	const char *key;
+	apr_size_t klen;
+	char *data;
+	apr_size_t len;
+} cat_cache_entry;
+
+
+/* A listing in the list cache, in a pool of its own */
+typedef struct list_cache_entry {
+	struct list_cache_entry *prev;  /* used more recently */
+	struct list_cache_entry *next;
+	apr_pool_t *pool;
+	const char *key;
+	apr_array_header_t *items;      /* of list_cache_item */
+} list_cache_entry;
+
+
+/* Stops the calls it is given to once cancelled, see svn.cancel_token */
+typedef struct cancel_token_t {
+	volatile apr_uint32_t cancelled;
+} cancel_token_t;
+
+#define LUASVN_CANCEL "luasvn.cancel"
+
+
+/* A client context that outlives a single call, see svn.client */
+typedef struct luasvn_client {
+	apr_pool_t *pool;
+	svn_client_ctx_t *ctx;
+	luasvn_client_opts opts;
+
+	ra_session_entry *sessions; /* most recently used first */
+	int nsessions;
+	int max_sessions;
+	apr_interval_time_t session_idle;
+	struct {
+		unsigned long hits;
+		unsigned long misses;
+		unsigned long expired;
+		unsigned long evicted;
+	} session_stats;
+
+	struct async_pool_t *async; /* worker threads, started on first use */
+	int async_threads;
+
+	/* Contents of files read by URL, by repository UUID, revision and
+	   path. Files at a revision never change, so entries only leave
+	   the cache to make room. */
+	struct {
+		apr_hash_t *entries;
+		cat_cache_entry *head;      /* most recently used first */
+		cat_cache_entry *tail;
+		apr_size_t size;            /* bytes of contents held */
+		apr_size_t max_size;        /* 0 disables the cache */
+		unsigned long hits;
+		unsigned long misses;
+		unsigned long evicted;
+	} cat_cache;
+
+	/* Listings of URLs, by path, depth, fields and last changed
+	   revision of the directory, see cached_list */
+	struct {
+		apr_hash_t *entries;
+		list_cache_entry *head;     /* most recently used first */
+		list_cache_entry *tail;
+		int max_entries;            /* 0 disables the cache */
+		unsigned long hits;
+		unsigned long misses;
+		unsigned long evicted;
+	} list_cache;
+
+	/* Contents of files read by cat, indexed by location and stored on
+	   disk by their MD5 digest, see cached_cat */
+	const char *cache_dir;
+	struct {
+		unsigned long hits;
+		unsigned long misses;
+		unsigned long stores;
+	} disk_cache;
+
+	/* Logs of URLs kept in the cache directory, see cached_log */
+	struct {
+		svn_boolean_t enabled;
+		unsigned long hits;         /* answered without the server */
+		unsigned long syncs;
+	} log_cache;
+
+	apr_interval_time_t timeout;  /* default time limit of a call, or 0 */
+	apr_time_t deadline;          /* of the running call, or 0 */
+	cancel_token_t *cancel_token; /* of the running call, or NULL */
+} luasvn_client;
+
+#define LUASVN_CLIENT "luasvn.client"
+#define LUASVN_DEFAULT_CLIENT "luasvn.default_client"
+
+#define DEFAULT_MAX_SESSIONS 4
+#define DEFAULT_SESSION_IDLE 60
+#define DEFAULT_ASYNC_THREADS 4
+
+static luasvn_client *get_client (lua_State *L);
+
+
+/* Creates a root pool with its own allocator */
+static apr_pool_t *
+create_pool (void) {
 	apr_allocator_t *allocator;
-	svn_auth_baton_t *ab;
-	svn_config_t *cfg;
+	apr_pool_t *pool;
+
+	if (apr_allocator_create(&allocator)) {
+		return NULL;
+	}
+
+	apr_allocator_max_free_set(allocator, SVN_ALLOCATOR_RECOMMENDED_MAX_FREE);
+
+	pool = svn_pool_create_ex(NULL, allocator);
+	apr_allocator_owner_set(allocator, pool);
+	return pool;
+}
+
+
+/* Initializes APR, the DSO loader and the RA layer once per process.
+   svn_cmdline_init registers apr_terminate with atexit, which releases
+   the global pool on exit. Returns an error message or NULL. */
+static const char *
+init_libraries (void) {
 	svn_error_t *err;
 
+	if (initialized) {
+		return NULL;
+	}
+
 	if (svn_cmdline_init("svn", NULL) != EXIT_SUCCESS) {
-		return send_error (L, "Error initializing svn\n");
+		return "Error initializing svn\n";
 	}
-	
-	if (apr_allocator_create(&allocator)) {
-		return send_error (L, "Error creating allocator\n");
+
+	err = svn_dso_initialize2();
+	if (err) {
+		svn_error_clear (err);
+		return "Error initializing the DSO loader\n";
 	}
 
-	apr_allocator_max_free_set(allocator, SVN_ALLOCATOR_RECOMMENDED_MAX_FREE);
+	global_pool = create_pool ();
+	if (global_pool == NULL) {
+		return "Error creating allocator\n";
+	}
+
+	err = svn_ra_initialize(global_pool);
+	if (err) {
+		svn_error_clear (err);
+		return "Error initializing the RA layer\n";
+	}
+
+	if (apr_atomic_init (global_pool)) {
+		return "Error initializing atomic operations\n";
+	}
+
+	if (apr_thread_mutex_create (&log_cache_mutex, APR_THREAD_MUTEX_DEFAULT, global_pool)) {
+		return "Error creating the log cache mutex\n";
+	}
+
+	initialized = 1;
+	return NULL;
+}
 
-  	*pool = svn_pool_create_ex(NULL, allocator);
-	apr_allocator_owner_set(allocator, *pool);
 
-  	err = svn_ra_initialize(*pool);
-	IF_ERROR_RETURN (err, *pool, L);
+/* Creates a client context, reading the configuration and building
+   the authentication baton as described by OPTS */
+static svn_error_t *
+create_context (svn_client_ctx_t **ctx, const luasvn_client_opts *opts, apr_pool_t *pool) {
+	svn_auth_baton_t *ab;
+	svn_config_t *cfg;
 
-	err = svn_client_create_context (ctx, *pool);
-	IF_ERROR_RETURN (err, *pool, L);
+	SVN_ERR (svn_client_create_context (ctx, pool));
 
-	err = svn_config_get_config(&((*ctx)->config),	NULL, *pool);
-	IF_ERROR_RETURN (err, *pool, L);
+	SVN_ERR (svn_config_get_config(&((*ctx)->config), opts->config_dir, pool));
 
 	cfg = apr_hash_get((*ctx)->config, SVN_CONFIG_CATEGORY_CONFIG,
 			APR_HASH_KEY_STRING);
 
-	err = svn_cmdline_create_auth_baton(&ab,
-			FALSE,
-			NULL,
-			NULL,
-			NULL,
-			FALSE,
-			FALSE,
+	SVN_ERR (svn_cmdline_create_auth_baton(&ab,
+			opts->non_interactive,
+			opts->username,
+			opts->password,
+			opts->config_dir,
+			opts->no_auth_cache,
+			opts->trust_server_cert,
 			cfg,
 			(*ctx)->cancel_func,
 			(*ctx)->cancel_baton,
-			*pool);
-	IF_ERROR_RETURN (err, *pool, L);
+			pool));
 
 	(*ctx)->auth_baton = ab;
-	return 0;
+	return SVN_NO_ERROR;
 }
 
 
-struct log_msg_baton
-{
-  const char *editor_cmd;  /* editor specified via --editor-cmd, else NULL */
-  const char *message;  /* the message. */
-  const char *message_encoding; /* the locale/encoding of the message. */
-  const char *base_dir; /* the base directory for an external edit. UTF-8! */
-  const char *tmpfile_left; /* the tmpfile left by an external edit. UTF-8! */
-  svn_boolean_t non_interactive; /* if true, don't pop up an editor */
-  apr_hash_t *config; /* client configuration hash */
-  svn_boolean_t keep_locks; /* Keep repository locks? */
-  apr_pool_t *pool; /* a pool. */
-  lua_State *L;
-};
+/* Cancel function of the context of a client. Stops the running call
+   once its token is cancelled or its deadline is over. */
+static svn_error_t *
+client_cancel (void *baton) {
+	luasvn_client *client = baton;
 
+	if (client->cancel_token != NULL && apr_atomic_read32 (&client->cancel_token->cancelled)) {
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, "Operation cancelled");
+	}
+	if (client->deadline != 0 && apr_time_now () > client->deadline) {
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, "Operation timed out");
+	}
+	return SVN_NO_ERROR;
+}
 
-svn_error_t *
-make_log_msg_baton(void **baton,
-		const char *message,
-		const char *base_dir /* UTF-8! */,
-		apr_hash_t *config,
-		apr_pool_t *pool,
-		lua_State *L)
-{
-  struct log_msg_baton *lmb = apr_palloc(pool, sizeof(*lmb));
 
-  lmb->message = message;
+/* Reads the timeout, in seconds, and the cancel token of a call from
+   the options at ITABLE. The timeout defaults to the one of CLIENT. */
+static void
+getcancelfields (lua_State *L, int itable, luasvn_client *client,
+				 apr_time_t *deadline, cancel_token_t **token) {
+	apr_interval_time_t timeout = client->timeout;
 
-  lmb->editor_cmd = NULL;;
-  
-  if (config)
-  {
- 	  svn_config_t *cfg = apr_hash_get(config, SVN_CONFIG_CATEGORY_CONFIG, 
-                                       APR_HASH_KEY_STRING);
-      svn_config_get(cfg, &(lmb->message_encoding),
-                     SVN_CONFIG_SECTION_MISCELLANY,
-                     SVN_CONFIG_OPTION_LOG_ENCODING,
-                     NULL);
-  } else 
-  {
-	  lmb->message_encoding = APR_LOCALE_CHARSET;
-  }
+	*token = NULL;
 
-  lmb->base_dir = base_dir ? base_dir : "";
-  lmb->tmpfile_left = NULL;
-  lmb->config = config;
-  lmb->keep_locks = FALSE;
-  lmb->non_interactive = TRUE;
-  lmb->pool = pool;
-  lmb->L = L;
-  *baton = lmb;
-  return SVN_NO_ERROR;
+	if (itable != 0 && lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		lua_getfield (L, itable, "timeout");
+		if (lua_isnumber (L, -1)) {
+			timeout = (apr_interval_time_t) (lua_tonumber (L, -1) * APR_USEC_PER_SEC);
+		}
+		lua_pop (L, 1);
+
+		lua_getfield (L, itable, "cancel");
+		if (!lua_isnil (L, -1)) {
+			svn_boolean_t valid = FALSE;
+
+			if (lua_getmetatable (L, -1)) {
+				luaL_getmetatable (L, LUASVN_CANCEL);
+				valid = lua_rawequal (L, -1, -2);
+				lua_pop (L, 2);
+			}
+			if (!valid) {
+				send_error (L, "The cancel option must be a cancel token\n");
+			}
+			*token = lua_touserdata (L, -1);
+		}
+		lua_pop (L, 1);
+	}
+
+	*deadline = timeout > 0 ? apr_time_now () + timeout : 0;
 }
 
-static svn_error_t *
-log_msg_func2 (const char **log_msg,
-		       const char **tmp_file,
-			   const apr_array_header_t *commit_items,
-			   void *baton,
-			   apr_pool_t *pool)
-{
-	struct log_msg_baton *lmb = baton;
 
-	svn_error_t *err = svn_utf_cstring_to_utf8 (log_msg, lmb->message, pool);
-	
-	if (err) {     
-	  return err;
-	} 
+/* The cancel state of a client before a call, given back when the pool
+   of the call is destroyed */
+typedef struct call_state {
+	luasvn_client *client;
+	apr_time_t deadline;
+	cancel_token_t *cancel_token;
+} call_state;
 
-	*tmp_file = NULL;
-	return SVN_NO_ERROR;
+
+static apr_status_t
+end_call (void *data) {
+	call_state *state = data;
+
+	state->client->deadline = state->deadline;
+	state->client->cancel_token = state->cancel_token;
+	return APR_SUCCESS;
 }
 
 
-static enum svn_opt_revision_kind
-get_revision_kind (const char *path) {
-	if (svn_path_is_url (path))
-		return svn_opt_revision_head;
-	return svn_opt_revision_base;
+/* Sets the deadline and the token checked by the cancel function of
+   CLIENT for as long as POOL lives. Calls run by the callbacks of a call
+   put back its own state once they are done. */
+static void
+begin_call (luasvn_client *client, apr_time_t deadline, cancel_token_t *token,
+			apr_pool_t *pool) {
+	call_state *state = apr_palloc (pool, sizeof (call_state));
+
+	state->client = client;
+	state->deadline = client->deadline;
+	state->cancel_token = client->cancel_token;
+	apr_pool_cleanup_register (pool, state, end_call, apr_pool_cleanup_null);
+
+	client->deadline = deadline;
+	client->cancel_token = token;
+}
+
+
+/* Gets the context for the running function. Methods of a client
+   object have the client as their first upvalue; plain functions use
+   the default client of the module. The context is reused and every
+   call gets a subpool of the client pool. The options at ITABLE, if
+   any, may give the timeout and the cancel token of the call. */
+static int
+init_function (svn_client_ctx_t **ctx, apr_pool_t **pool, lua_State *L, int itable) {
+	luasvn_client *client = get_client (L);
+	cancel_token_t *token;
+	apr_time_t deadline;
+
+	getcancelfields (L, itable, client, &deadline, &token);
+
+	*pool = svn_pool_create (client->pool);
+	begin_call (client, deadline, token, *pool);
+	*ctx = client->ctx;
+	(*ctx)->log_msg_func2 = NULL;
+	(*ctx)->log_msg_baton2 = NULL;
+	return 0;
 }
 
+
+/* Closes the session of ENTRY and removes it from the client */
 static void
-setdepth (svn_depth_t *depth, const char *s) {
-	const char adepth[6][10] = {"unkonwn", "exclude", "empty", "files",
-		                        "immediates", "infinity"};
-	int i = svn_depth_unknown;
-	while(i <= svn_depth_infinity) {
-		if(!strcmp(s, adepth[i])) {
-			*depth = i;
+session_close (luasvn_client *client, ra_session_entry *entry) {
+	ra_session_entry **p;
+
+	for (p = &client->sessions; *p != NULL; p = &(*p)->next) {
+		if (*p == entry) {
+			*p = entry->next;
 			break;
 		}
-		i++;
 	}
+	client->nsessions--;
+	svn_pool_destroy (entry->pool);
 }
 
-static void getdepthfield(lua_State *L, int itable, int index, svn_boolean_t *b) {
-	lua_getfield (L, itable, "depth");
-	if (lua_isstring (L, index)) {
-		setdepth(b, lua_tostring(L, index));
-	}
-}
 
-static void getboolfield(lua_State *L, int itable, const char *field,
-						 int index, svn_boolean_t *b) {
-	lua_getfield (L, itable, field);
-	if (lua_isboolean (L, index)) {
-		*b = lua_toboolean (L, index);
+/* Closes the sessions that were not used for longer than the idle time */
+static void
+session_expire (luasvn_client *client, apr_time_t now) {
+	ra_session_entry *entry = client->sessions;
+
+	while (entry != NULL) {
+		ra_session_entry *next = entry->next;
+		if (!entry->in_use && now - entry->last_used > client->session_idle) {
+			session_close (client, entry);
+			client->session_stats.expired++;
+		}
+		entry = next;
 	}
 }
 
-static int
-l_add (lua_State *L) {
-	apr_pool_t *pool;
+
+/* Gets an open session for URL, reusing a cached session of the same
+   repository when there is one. The session must be given back with
+   session_release. */
+static svn_error_t *
+session_acquire (ra_session_entry **entry, luasvn_client *client,
+				 const char *url, apr_pool_t *pool) {
+	ra_session_entry *e, *lru = NULL;
 	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-	
-	const char *path = luaL_checkstring (L, 1);
-	int itable = 2;
-	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t force = FALSE;
-	svn_boolean_t no_ignore = FALSE;
-	svn_boolean_t add_parents = FALSE;
+	apr_pool_t *subpool;
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "force", -1, &force);
-		getboolfield(L, itable, "no_ignore", -1, &no_ignore);
-		getboolfield(L, itable, "add_parents", -1, &add_parents);
-	} 
+	session_expire (client, apr_time_now ());
 
-	init_function (&ctx, &pool, L);
+	for (e = client->sessions; e != NULL; e = e->next) {
+		if (!e->in_use && svn_path_is_ancestor (e->root, url)) {
+			err = svn_ra_reparent (e->session, url, pool);
+			if (err) {
+				session_close (client, e);
+				return err;
+			}
+			client->session_stats.hits++;
+			e->in_use = TRUE;
+			*entry = e;
+			return SVN_NO_ERROR;
+		}
+		if (!e->in_use) {
+			lru = e;
+		}
+	}
 
-	path = svn_path_canonicalize (path, pool);
+	client->session_stats.misses++;
 
-	err = svn_client_add4 (path, depth, force, no_ignore, add_parents, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	if (client->nsessions >= client->max_sessions && lru != NULL) {
+		session_close (client, lru);
+		client->session_stats.evicted++;
+	}
 
-	svn_pool_destroy (pool);
-	return 0;
-}
+	subpool = svn_pool_create (client->pool);
+	e = apr_pcalloc (subpool, sizeof (ra_session_entry));
+	e->pool = subpool;
 
+	err = svn_client_open_ra_session (&e->session, url, client->ctx, subpool);
+	if (!err) {
+		err = svn_ra_get_repos_root (e->session, &e->root, subpool);
+	}
+	if (err) {
+		svn_pool_destroy (subpool);
+		return err;
+	}
 
-static svn_error_t *
-write_fn (void *baton, const char *data, apr_size_t *len) {
-	svn_stringbuf_appendbytes (baton, data, *len);
+	e->in_use = TRUE;
+	e->next = client->sessions;
+	client->sessions = e;
+	client->nsessions++;
 
+	*entry = e;
 	return SVN_NO_ERROR;
 }
 
 
-static int
-l_cat (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-	
-	svn_stream_t *stream;
-	svn_stringbuf_t *buffer;
-	svn_opt_revision_t peg_revision;
-	svn_opt_revision_t revision;
+#define IN_ERR_CATEGORY(code, start) \
+	((code) >= (start) && (code) < (start) + SVN_ERR_CATEGORY_SIZE)
+
+/* Tells whether ERR may have left the connection of a session in a bad
+   state: errors of the RA layers, I/O errors and calls cancelled in the
+   middle of a request. A missing path or a callback that stopped the
+   call leave the session usable. */
+static svn_boolean_t
+session_broken (svn_error_t *err) {
+	for (; err != NULL; err = err->child) {
+		apr_status_t code = err->apr_err;
+
+		if (code < SVN_ERR_BAD_CATEGORY_START
+				|| code == SVN_ERR_CANCELLED
+				|| IN_ERR_CATEGORY (code, SVN_ERR_IO_CATEGORY_START)
+				|| IN_ERR_CATEGORY (code, SVN_ERR_STREAM_CATEGORY_START)
+				|| IN_ERR_CATEGORY (code, SVN_ERR_RA_CATEGORY_START)
+				|| IN_ERR_CATEGORY (code, SVN_ERR_RA_DAV_CATEGORY_START)
+				|| IN_ERR_CATEGORY (code, SVN_ERR_RA_LOCAL_CATEGORY_START)
+				|| IN_ERR_CATEGORY (code, SVN_ERR_RA_SVN_CATEGORY_START)
+				|| IN_ERR_CATEGORY (code, SVN_ERR_RA_SERF_CATEGORY_START)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
 
-	const char *path = luaL_checkstring (L, 1);
-	peg_revision.kind = svn_opt_revision_unspecified;
 
-	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		revision.kind = get_revision_kind (path);
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 2);
+/* Gives back a session got with session_acquire. A session that failed
+   in a way that may have broken its connection is closed. */
+static void
+session_release (luasvn_client *client, ra_session_entry *entry, svn_error_t *err) {
+	ra_session_entry **p;
+
+	entry->in_use = FALSE;
+	entry->last_used = apr_time_now ();
+
+	if (session_broken (err) || client->nsessions > client->max_sessions) {
+		session_close (client, entry);
+		return;
 	}
 
-	init_function (&ctx, &pool, L);
+	/* Moves the entry to the front of the list */
+	for (p = &client->sessions; *p != NULL; p = &(*p)->next) {
+		if (*p == entry) {
+			*p = entry->next;
+			break;
+		}
+	}
+	entry->next = client->sessions;
+	client->sessions = entry;
+}
 
-	path = svn_path_canonicalize (path, pool);
 
-	stream = svn_stream_empty (pool);
-	svn_stream_set_write (stream, write_fn);
+/* Gets the revision number for REVISION, asking the repository for the
+   youngest revision unless a number is given */
+static svn_error_t *
+session_revnum (svn_revnum_t *revnum, svn_ra_session_t *session,
+				const svn_opt_revision_t *revision, apr_pool_t *pool) {
+	if (revision->kind == svn_opt_revision_number) {
+		*revnum = revision->value.number;
+		return SVN_NO_ERROR;
+	}
+	return svn_ra_get_latest_revnum (session, revnum, pool);
+}
 
-	buffer = svn_stringbuf_create ("\0", pool);
 
-	svn_stream_set_baton (stream, buffer);
+/* Writes the contents of the file at PATH, relative to the session, in
+   REV to OUT, translating keywords and end of lines like svn_client_cat2.
+   URL is the URL of the file, used to expand the keywords. With SPOOL,
+   the contents and the properties come in one request and the contents
+   wait in SPOOL; without it the file is streamed, but it takes a first
+   request for the properties. */
+static svn_error_t *
+session_cat (svn_ra_session_t *session, const char *url, const char *path,
+			 svn_revnum_t rev, svn_stream_t *out, svn_stringbuf_t *spool,
+			 apr_pool_t *pool) {
+	apr_hash_t *props;
+	svn_string_t *eol_style;
+	svn_string_t *keywords;
+	apr_hash_t *kw = NULL;
+	const char *eol = NULL;
+	svn_subst_eol_style_t style;
+	svn_stream_t *output = out;
+
+	if (spool != NULL) {
+		svn_stringbuf_setempty (spool);
+		SVN_ERR (svn_ra_get_file (session, path, rev, svn_stream_from_stringbuf (spool, pool),
+								  NULL, &props, pool));
+	} else {
+		/* The contents are read in the revision the properties came from */
+		SVN_ERR (svn_ra_get_file (session, path, rev, NULL, &rev, &props, pool));
+	}
 
-	err = svn_client_cat2 (stream, path, &peg_revision, &revision, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	eol_style = apr_hash_get (props, SVN_PROP_EOL_STYLE, APR_HASH_KEY_STRING);
+	keywords = apr_hash_get (props, SVN_PROP_KEYWORDS, APR_HASH_KEY_STRING);
 
-	lua_pushstring (L, buffer->data);
+	if (eol_style) {
+		svn_subst_eol_style_from_value (&style, &eol, eol_style->data);
+	}
 
-	svn_pool_destroy (pool);
-	return 1;
-}
+	if (keywords) {
+		svn_string_t *cmt_rev, *cmt_date, *cmt_author;
+		apr_time_t when = 0;
 
+		cmt_rev = apr_hash_get (props, SVN_PROP_ENTRY_COMMITTED_REV, APR_HASH_KEY_STRING);
+		cmt_date = apr_hash_get (props, SVN_PROP_ENTRY_COMMITTED_DATE, APR_HASH_KEY_STRING);
+		cmt_author = apr_hash_get (props, SVN_PROP_ENTRY_LAST_AUTHOR, APR_HASH_KEY_STRING);
+		if (cmt_date) {
+			SVN_ERR (svn_time_from_cstring (&when, cmt_date->data, pool));
+		}
 
-static int
-l_checkout (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+		SVN_ERR (svn_subst_build_keywords2 (&kw, keywords->data,
+					cmt_rev ? cmt_rev->data : "", url, when,
+					cmt_author ? cmt_author->data : NULL, pool));
+	}
 
-	svn_opt_revision_t revision;
-	svn_opt_revision_t peg_revision;
-	svn_revnum_t rev;
+	/* Closing the translating stream must not close the caller's one */
+	if (eol || kw) {
+		output = svn_subst_stream_translated (svn_stream_disown (out, pool), eol, FALSE,
+											  kw, TRUE, pool);
+	}
 
-	const char *path = luaL_checkstring (L, 1);
-	const char *dir = luaL_checkstring (L, 2);
+	if (spool != NULL) {
+		apr_size_t len = spool->len;
+
+		SVN_ERR (svn_stream_write (output, spool->data, &len));
+	} else {
+		SVN_ERR (svn_ra_get_file (session, path, rev, output, NULL, NULL, pool));
+	}
+
+	if (output != out) {
+		SVN_ERR (svn_stream_close (output));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Finds where the file at URL in HEAD was in REV, following its
+   history like svn_client_cat2 does for a URL without a peg revision.
+   URL is set to the URL of the file in REV, and SESSION, of the
+   repository at ROOT, is reparented to it. */
+static svn_error_t *
+session_trace (const char **url, svn_ra_session_t *session, const char *root,
+			   svn_revnum_t rev, apr_pool_t *pool) {
+	svn_revnum_t head;
+	apr_array_header_t *revs;
+	apr_hash_t *locations;
+	const char *path;
+
+	SVN_ERR (svn_ra_get_latest_revnum (session, &head, pool));
+	if (rev == head) {
+		return SVN_NO_ERROR;
+	}
+
+	revs = apr_array_make (pool, 1, sizeof (svn_revnum_t));
+	APR_ARRAY_PUSH (revs, svn_revnum_t) = rev;
+	SVN_ERR (svn_ra_get_locations (session, &locations, "", head, revs, pool));
+
+	path = apr_hash_get (locations, &rev, sizeof (svn_revnum_t));
+	if (path == NULL) {
+		return svn_error_createf (SVN_ERR_CLIENT_UNRELATED_RESOURCES, NULL,
+								  "Unable to find repository location for '%s' in revision %ld",
+								  *url, rev);
+	}
+
+	path = svn_path_url_add_component2 (root, path + 1, pool);
+	if (strcmp (path, *url) != 0) {
+		SVN_ERR (svn_ra_reparent (session, path, pool));
+		*url = path;
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Gets the UUID of the repository of the session of ENTRY, asking for
+   it only once */
+static svn_error_t *
+session_uuid (const char **uuid, ra_session_entry *entry) {
+	if (entry->uuid == NULL) {
+		SVN_ERR (svn_ra_get_uuid2 (entry->session, &entry->uuid, entry->pool));
+	}
+	*uuid = entry->uuid;
+	return SVN_NO_ERROR;
+}
+
+
+static void
+cat_cache_unlink (luasvn_client *client, cat_cache_entry *e) {
+	if (e->prev != NULL) {
+		e->prev->next = e->next;
+	} else {
+		client->cat_cache.head = e->next;
+	}
+	if (e->next != NULL) {
+		e->next->prev = e->prev;
+	} else {
+		client->cat_cache.tail = e->prev;
+	}
+	e->prev = e->next = NULL;
+}
+
+
+static void
+cat_cache_push_front (luasvn_client *client, cat_cache_entry *e) {
+	e->prev = NULL;
+	e->next = client->cat_cache.head;
+	if (e->next != NULL) {
+		e->next->prev = e;
+	} else {
+		client->cat_cache.tail = e;
+	}
+	client->cat_cache.head = e;
+}
+
+
+static void
+cat_cache_remove (luasvn_client *client, cat_cache_entry *e) {
+	apr_hash_set (client->cat_cache.entries, e->key, e->klen, NULL);
+	cat_cache_unlink (client, e);
+	client->cat_cache.size -= e->len;
+	free (e);
+}
+
+
+/* Drops the least recently used files until the cache holds at most
+   MAX_SIZE bytes */
+static void
+cat_cache_trim (luasvn_client *client, apr_size_t max_size) {
+	while (client->cat_cache.tail != NULL && client->cat_cache.size > max_size) {
+		cat_cache_remove (client, client->cat_cache.tail);
+		client->cat_cache.evicted++;
+	}
+}
+
+
+/* Gets the entry of KEY and makes it the most recently used one */
+static cat_cache_entry *
+cat_cache_get (luasvn_client *client, const char *key) {
+	cat_cache_entry *e = NULL;
+
+	if (client->cat_cache.entries != NULL) {
+		e = apr_hash_get (client->cat_cache.entries, key, APR_HASH_KEY_STRING);
+	}
+
+	if (e == NULL) {
+		client->cat_cache.misses++;
+		return NULL;
+	}
+
+	client->cat_cache.hits++;
+	cat_cache_unlink (client, e);
+	cat_cache_push_front (client, e);
+	return e;
+}
+
+
+/* Adds a copy of the LEN bytes of DATA as the contents of KEY. Files
+   larger than the whole cache are left out. */
+static void
+cat_cache_put (luasvn_client *client, const char *key, const char *data, apr_size_t len) {
+	apr_size_t klen = strlen (key);
+	cat_cache_entry *e;
+
+	if (len > client->cat_cache.max_size) {
+		return;
+	}
+
+	if (client->cat_cache.entries == NULL) {
+		client->cat_cache.entries = apr_hash_make (client->pool);
+	}
+
+	e = apr_hash_get (client->cat_cache.entries, key, klen);
+	if (e != NULL) {
+		cat_cache_remove (client, e);
+	}
+
+	cat_cache_trim (client, client->cat_cache.max_size - len);
+
+	e = malloc (sizeof (cat_cache_entry) + klen + 1 + len);
+	if (e == NULL) {
+		return;
+	}
+
+	memcpy ((char *) (e + 1), key, klen + 1);
+	e->key = (const char *) (e + 1);
+	e->klen = klen;
+	e->data = (char *) (e + 1) + klen + 1;
+	memcpy (e->data, data, len);
+	e->len = len;
+
+	cat_cache_push_front (client, e);
+	apr_hash_set (client->cat_cache.entries, e->key, e->klen, e);
+	client->cat_cache.size += len;
+}
+
+
+/* A file of the disk cache being written */
+typedef struct disk_cache_file {
+	const char *tmp_path;
+	svn_stream_t *stream;
+	svn_checksum_t *checksum;   /* MD5 of the contents, once closed */
+	svn_boolean_t failed;
+} disk_cache_file;
+
+
+/* Gets the path of the file named by the digest HEX in the SUBDIR of the
+   disk cache of CLIENT. The first two digits name a directory, so that
+   none gets too large. */
+static const char *
+disk_cache_path (luasvn_client *client, const char *subdir, const char *hex,
+				 apr_pool_t *pool) {
+	return svn_path_join_many (pool, client->cache_dir, subdir,
+							   apr_pstrndup (pool, hex, 2), hex + 2, NULL);
+}
+
+
+/* Gets the path of the index file of KEY, which holds the digest of the
+   contents of KEY */
+static svn_error_t *
+disk_cache_index_path (const char **path, luasvn_client *client,
+					   const char *key, apr_pool_t *pool) {
+	svn_checksum_t *checksum;
+
+	SVN_ERR (svn_checksum (&checksum, svn_checksum_md5, key, strlen (key), pool));
+	*path = disk_cache_path (client, "index",
+							 svn_checksum_to_cstring_display (checksum, pool), pool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Copies the contents of KEY from the disk cache of CLIENT to OUT.
+   FOUND is set to FALSE when the cache does not have them. HEX, when
+   given, is set to the digest of the contents. */
+static svn_error_t *
+disk_cache_read (svn_boolean_t *found, luasvn_client *client, const char *key,
+				 svn_stream_t *out, const char **hex_out, apr_pool_t *pool) {
+	const char *path;
+	svn_stringbuf_t *hex;
+	svn_stream_t *in;
+	svn_error_t *err;
+
+	*found = FALSE;
+
+	SVN_ERR (disk_cache_index_path (&path, client, key, pool));
+
+	/* Missing or broken files are misses */
+	err = svn_stringbuf_from_file2 (&hex, path, pool);
+	if (!err) {
+		if (hex->len != 2 * APR_MD5_DIGESTSIZE) {
+			return SVN_NO_ERROR;
+		}
+		err = svn_stream_open_readonly (&in, disk_cache_path (client, "objects", hex->data, pool),
+										pool, pool);
+	}
+	if (err) {
+		svn_error_clear (err);
+		return SVN_NO_ERROR;
+	}
+
+	*found = TRUE;
+	if (hex_out != NULL) {
+		*hex_out = hex->data;
+	}
+	return svn_stream_copy3 (in, svn_stream_disown (out, pool),
+							 client->ctx->cancel_func, client->ctx->cancel_baton, pool);
+}
+
+
+/* Opens a temporary file in the disk cache of CLIENT */
+static svn_error_t *
+disk_cache_open (disk_cache_file *file, luasvn_client *client, apr_pool_t *pool) {
+	const char *dir = svn_path_join (client->cache_dir, "tmp", pool);
+	apr_file_t *f;
+
+	SVN_ERR (svn_io_make_dir_recursively (dir, pool));
+	SVN_ERR (svn_io_open_unique_file3 (&f, &file->tmp_path, dir,
+									   svn_io_file_del_none, pool, pool));
+
+	file->checksum = NULL;
+	file->failed = FALSE;
+	file->stream = svn_stream_checksummed2 (svn_stream_from_aprfile2 (f, FALSE, pool),
+											NULL, &file->checksum, svn_checksum_md5,
+											FALSE, pool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Makes the contents with the digest HEX those of KEY */
+static svn_error_t *
+disk_cache_link (luasvn_client *client, const char *key, const char *hex,
+				 apr_pool_t *pool) {
+	const char *path, *tmp_path;
+
+	SVN_ERR (disk_cache_index_path (&path, client, key, pool));
+	SVN_ERR (svn_io_make_dir_recursively (svn_path_dirname (path, pool), pool));
+	SVN_ERR (svn_io_write_unique (&tmp_path, svn_path_join (client->cache_dir, "tmp", pool),
+								  hex, strlen (hex), svn_io_file_del_none, pool));
+	return svn_io_file_rename (tmp_path, path, pool);
+}
+
+
+/* Closes FILE and stores it as the contents of KEY and, if given, of
+   NODE_KEY. The files are renamed into place, so that readers, even
+   from other processes, never see them half written. */
+static svn_error_t *
+disk_cache_store (disk_cache_file *file, luasvn_client *client, const char *key,
+				  const char *node_key, apr_pool_t *pool) {
+	const char *hex, *path;
+	svn_error_t *err = svn_stream_close (file->stream);
+
+	/* A failed close is not retried by disk_cache_abort */
+	file->stream = NULL;
+	SVN_ERR (err);
+	hex = svn_checksum_to_cstring_display (file->checksum, pool);
+
+	path = disk_cache_path (client, "objects", hex, pool);
+	SVN_ERR (svn_io_make_dir_recursively (svn_path_dirname (path, pool), pool));
+	SVN_ERR (svn_io_file_rename (file->tmp_path, path, pool));
+
+	if (node_key != NULL && strcmp (node_key, key) != 0) {
+		SVN_ERR (disk_cache_link (client, node_key, hex, pool));
+	}
+	return disk_cache_link (client, key, hex, pool);
+}
+
+
+/* Drops FILE, which could not be written or stored */
+static void
+disk_cache_abort (disk_cache_file *file, apr_pool_t *pool) {
+	if (file->stream != NULL) {
+		svn_error_clear (svn_stream_close (file->stream));
+		file->stream = NULL;
+	}
+	svn_error_clear (svn_io_remove_file (file->tmp_path, pool));
+}
+
+
+/* Writes to OUT, keeps a copy of what it writes in CAPTURE until it is
+   over LIMIT bytes, and writes it to the disk cache FILE. CAPTURE and
+   FILE may be NULL. */
+typedef struct tee_bt {
+	svn_stream_t *out;
+	svn_stringbuf_t *capture;
+	apr_size_t limit;
+	svn_boolean_t overflow;
+	disk_cache_file *file;
+} tee_bt;
+
+
+static svn_error_t *
+tee_write (void *baton, const char *data, apr_size_t *len) {
+	tee_bt *tb = baton;
+
+	if (tb->capture != NULL && !tb->overflow) {
+		if (tb->capture->len + *len > tb->limit) {
+			tb->overflow = TRUE;
+			svn_stringbuf_setempty (tb->capture);
+		} else {
+			svn_stringbuf_appendbytes (tb->capture, data, *len);
+		}
+	}
+
+	/* The cache never makes a read fail */
+	if (tb->file != NULL && !tb->file->failed) {
+		apr_size_t flen = *len;
+		svn_error_t *err = svn_stream_write (tb->file->stream, data, &flen);
+
+		if (err) {
+			svn_error_clear (err);
+			tb->file->failed = TRUE;
+		}
+	}
+	return svn_stream_write (tb->out, data, len);
+}
+
+
+/* Writes the contents of URL, at PATH relative to the session of ENTRY,
+   in REV to OUT like session_cat, going through the cat cache and the
+   disk cache of CLIENT when they are enabled. BUFFER, when given, is
+   grown to the size of the file when the disk cache stats it. SPOOL is
+   given to session_cat.
+
+   The disk cache is looked up by location, not by contents: Subversion
+   1.6 reports no checksum through svn_ra_stat or svn_ra_get_file before
+   the file is transferred. It knows the contents of a file by the
+   revision it was read in and by the revision it was last changed in,
+   both under the key "uuid:revision:path". The first needs no request;
+   the second, got with a stat, still finds a file that did not change
+   since it was read in an older revision. Only the storage is by
+   digest, so that identical files read at other paths share one copy
+   on disk; they are still transferred once. */
+static svn_error_t *
+cached_cat (luasvn_client *client, ra_session_entry *entry, const char *url,
+			const char *path, svn_revnum_t rev, svn_stream_t *out,
+			svn_stringbuf_t *buffer, svn_stringbuf_t *spool, apr_pool_t *pool) {
+	const char *uuid, *key, *relpath;
+	const char *node_key = NULL;
+	disk_cache_file file = {NULL, NULL, NULL, FALSE};
+	cat_cache_entry *e;
+	svn_boolean_t found;
+	svn_error_t *err;
+	tee_bt tb;
+	apr_size_t len;
+
+	if (client->cat_cache.max_size == 0 && client->cache_dir == NULL) {
+		return session_cat (entry->session, url, path, rev, out, spool, pool);
+	}
+
+	if (!SVN_IS_VALID_REVNUM (rev)) {
+		SVN_ERR (svn_ra_get_latest_revnum (entry->session, &rev, pool));
+	}
+	SVN_ERR (session_uuid (&uuid, entry));
+	relpath = url + strlen (entry->root);
+	key = apr_psprintf (pool, "%s:%ld:%s", uuid, rev, relpath);
+
+	tb.out = out;
+	tb.capture = NULL;
+	tb.limit = client->cat_cache.max_size;
+	tb.overflow = FALSE;
+	tb.file = NULL;
+
+	if (client->cat_cache.max_size > 0) {
+		e = cat_cache_get (client, key);
+		if (e != NULL) {
+			len = e->len;
+			return svn_stream_write (out, e->data, &len);
+		}
+		tb.capture = svn_stringbuf_create ("", pool);
+	}
+
+	out = svn_stream_create (&tb, pool);
+	svn_stream_set_write (out, tee_write);
+
+	if (client->cache_dir != NULL) {
+		const char *hex;
+
+		SVN_ERR (disk_cache_read (&found, client, key, out, NULL, pool));
+		if (!found) {
+			svn_dirent_t *dirent = NULL;
+
+			SVN_ERR (svn_ra_stat (entry->session, path, rev, &dirent, pool));
+			if (dirent != NULL && dirent->kind == svn_node_file) {
+				node_key = apr_psprintf (pool, "%s:%ld:%s", uuid, dirent->created_rev, relpath);
+
+				/* The stat also sizes the buffer */
+				if (buffer != NULL) {
+					svn_stringbuf_ensure (buffer, (apr_size_t) dirent->size + 1);
+					buffer = NULL;
+				}
+
+				SVN_ERR (disk_cache_read (&found, client, node_key, out, &hex, pool));
+				if (found) {
+					svn_error_clear (disk_cache_link (client, key, hex, pool));
+				}
+			}
+		}
+		if (found) {
+			client->disk_cache.hits++;
+			if (tb.capture != NULL && !tb.overflow) {
+				cat_cache_put (client, key, tb.capture->data, tb.capture->len);
+			}
+			return SVN_NO_ERROR;
+		}
+		client->disk_cache.misses++;
+
+		err = disk_cache_open (&file, client, pool);
+		if (err) {
+			svn_error_clear (err);
+		} else {
+			tb.file = &file;
+		}
+	}
+
+	err = session_cat (entry->session, url, path, rev, out, spool, pool);
+
+	if (tb.file != NULL) {
+		svn_error_t *store_err = SVN_NO_ERROR;
+
+		if (err || file.failed
+				|| (store_err = disk_cache_store (&file, client, key, node_key, pool))) {
+			svn_error_clear (store_err);
+			disk_cache_abort (&file, pool);
+		} else {
+			client->disk_cache.stores++;
+		}
+	}
+	SVN_ERR (err);
+
+	if (tb.capture != NULL && !tb.overflow) {
+		cat_cache_put (client, key, tb.capture->data, tb.capture->len);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+struct log_msg_baton
+{
+  const char *editor_cmd;  /* editor specified via --editor-cmd, else NULL */
+  const char *message;  /* the message. */
+  const char *message_encoding; /* the locale/encoding of the message. */
+  const char *base_dir; /* the base directory for an external edit. UTF-8! */
+  const char *tmpfile_left; /* the tmpfile left by an external edit. UTF-8! */
+  svn_boolean_t non_interactive; /* if true, don't pop up an editor */
+  apr_hash_t *config; /* client configuration hash */
+  svn_boolean_t keep_locks; /* Keep repository locks? */
+  apr_pool_t *pool; /* a pool. */
+  lua_State *L;
+};
+
+
+svn_error_t *
+make_log_msg_baton(void **baton,
+		const char *message,
+		const char *base_dir /* UTF-8! */,
+		apr_hash_t *config,
+		apr_pool_t *pool,
+		lua_State *L)
+{
+  struct log_msg_baton *lmb = apr_palloc(pool, sizeof(*lmb));
+
+  lmb->message = message;
+
+  lmb->editor_cmd = NULL;;
+  
+  if (config)
+  {
+ 	  svn_config_t *cfg = apr_hash_get(config, SVN_CONFIG_CATEGORY_CONFIG, 
+                                       APR_HASH_KEY_STRING);
+      svn_config_get(cfg, &(lmb->message_encoding),
+                     SVN_CONFIG_SECTION_MISCELLANY,
+                     SVN_CONFIG_OPTION_LOG_ENCODING,
+                     NULL);
+  } else 
+  {
+	  lmb->message_encoding = APR_LOCALE_CHARSET;
+  }
+
+  lmb->base_dir = base_dir ? base_dir : "";
+  lmb->tmpfile_left = NULL;
+  lmb->config = config;
+  lmb->keep_locks = FALSE;
+  lmb->non_interactive = TRUE;
+  lmb->pool = pool;
+  lmb->L = L;
+  *baton = lmb;
+  return SVN_NO_ERROR;
+}
+
+static svn_error_t *
+log_msg_func2 (const char **log_msg,
+		       const char **tmp_file,
+			   const apr_array_header_t *commit_items,
+			   void *baton,
+			   apr_pool_t *pool)
+{
+	struct log_msg_baton *lmb = baton;
+
+	svn_error_t *err = svn_utf_cstring_to_utf8 (log_msg, lmb->message, pool);
+	
+	if (err) {     
+	  return err;
+	} 
+
+	*tmp_file = NULL;
+	return SVN_NO_ERROR;
+}
+
+
+static enum svn_opt_revision_kind
+get_revision_kind (const char *path) {
+	if (svn_path_is_url (path))
+		return svn_opt_revision_head;
+	return svn_opt_revision_base;
+}
+
+static void
+setdepth (svn_depth_t *depth, const char *s) {
+	const char adepth[6][10] = {"unkonwn", "exclude", "empty", "files",
+		                        "immediates", "infinity"};
+	int i = svn_depth_unknown;
+	while(i <= svn_depth_infinity) {
+		if(!strcmp(s, adepth[i])) {
+			*depth = i;
+			break;
+		}
+		i++;
+	}
+}
+
+static void getdepthfield(lua_State *L, int itable, int index, svn_boolean_t *b) {
+	lua_getfield (L, itable, "depth");
+	if (lua_isstring (L, index)) {
+		setdepth(b, lua_tostring(L, index));
+	}
+}
+
+static void getboolfield(lua_State *L, int itable, const char *field,
+						 int index, svn_boolean_t *b) {
+	lua_getfield (L, itable, field);
+	if (lua_isboolean (L, index)) {
+		*b = lua_toboolean (L, index);
+	}
+}
+
+static void
+getintfield (lua_State *L, int itable, const char *field,
+			 int index, int *i) {
+	lua_getfield (L, itable, field);
+	if (lua_isnumber (L, index)) {
+		*i = lua_tointeger (L, index);
+	}
+}
+
+/* Checks that the value at INDEX is a path or an array of paths */
+static void
+checkpaths (lua_State *L, int index) {
+	int i, n;
+
+	if (!lua_istable (L, index)) {
+		luaL_checkstring (L, index);
+		return;
+	}
+
+	n = lua_objlen (L, index);
+	luaL_argcheck (L, n > 0, index, "empty array of paths");
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti (L, index, i);
+		luaL_argcheck (L, lua_isstring (L, -1), index, "paths must be strings");
+		lua_pop (L, 1);
+	}
+}
+
+
+/* Gets the path or the array of paths at INDEX, checked with checkpaths,
+   as an array of canonical paths */
+static apr_array_header_t *
+getpatharray (lua_State *L, int index, apr_pool_t *pool) {
+	apr_array_header_t *array;
+	int i, n;
+
+	if (!lua_istable (L, index)) {
+		array = apr_array_make (pool, 1, sizeof (const char *));
+		APR_ARRAY_PUSH (array, const char *) =
+			svn_path_canonicalize (lua_tostring (L, index), pool);
+		return array;
+	}
+
+	n = lua_objlen (L, index);
+	array = apr_array_make (pool, n, sizeof (const char *));
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti (L, index, i);
+		APR_ARRAY_PUSH (array, const char *) =
+			svn_path_canonicalize (lua_tostring (L, -1), pool);
+		lua_pop (L, 1);
+	}
+	return array;
+}
+
+
+static int
+l_add (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+	
+	apr_array_header_t *array;
+	apr_pool_t *iterpool;
+	int i;
+
+	int itable = 2;
+	svn_depth_t depth = svn_depth_infinity;
+	svn_boolean_t force = FALSE;
+	svn_boolean_t no_ignore = FALSE;
+	svn_boolean_t add_parents = FALSE;
+
+	checkpaths (L, 1);
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "force", -1, &force);
+		getboolfield(L, itable, "no_ignore", -1, &no_ignore);
+		getboolfield(L, itable, "add_parents", -1, &add_parents);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	array = getpatharray (L, 1, pool);
+	iterpool = svn_pool_create (pool);
+
+	for (i = 0; i < array->nelts; i++) {
+		svn_pool_clear (iterpool);
+		err = svn_client_add4 (APR_ARRAY_IDX (array, i, const char *), depth, force,
+							   no_ignore, add_parents, ctx, iterpool);
+		IF_ERROR_RETURN (err, pool, L);
+	}
+
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+/* Returns a new cancel token, given to calls with the cancel option.
+   A blocking call can only be cancelled from its callbacks or from
+   another thread, as the Lua thread is busy running it. */
+static int
+l_cancel_token (lua_State *L) {
+	cancel_token_t *token = lua_newuserdata (L, sizeof (cancel_token_t));
+
+	apr_atomic_set32 (&token->cancelled, 0);
+	luaL_getmetatable (L, LUASVN_CANCEL);
+	lua_setmetatable (L, -2);
+	return 1;
+}
+
+
+static int
+cancel_token_cancel (lua_State *L) {
+	cancel_token_t *token = luaL_checkudata (L, 1, LUASVN_CANCEL);
+
+	apr_atomic_set32 (&token->cancelled, 1);
+	return 0;
+}
+
+
+static int
+cancel_token_cancelled (lua_State *L) {
+	cancel_token_t *token = luaL_checkudata (L, 1, LUASVN_CANCEL);
+
+	lua_pushboolean (L, apr_atomic_read32 (&token->cancelled) != 0);
+	return 1;
+}
+
+
+static const struct luaL_Reg cancel_token_methods [] = {
+	{"cancel", cancel_token_cancel},
+	{"cancelled", cancel_token_cancelled},
+	{NULL, NULL}
+};
+
+
+static svn_error_t *
+write_fn (void *baton, const char *data, apr_size_t *len) {
+	svn_stringbuf_appendbytes (baton, data, *len);
+
+	return SVN_NO_ERROR;
+}
+
+
+static svn_error_t *
+buffer_write_fn (void *baton, const char *data, apr_size_t *len) {
+	luaL_addlstring (baton, data, *len);
+
+	return SVN_NO_ERROR;
+}
+
+
+/* Writes the contents of PATH in REVISION to STREAM. URLs are read
+   through the session and cat caches of CLIENT. BUFFER, when given,
+   receives the whole file: it then comes in a single request, through
+   a spool, instead of being streamed. */
+static svn_error_t *
+cat_path (luasvn_client *client, const char *path,
+		  const svn_opt_revision_t *revision, svn_stream_t *stream,
+		  svn_stringbuf_t *buffer, apr_pool_t *pool) {
+	svn_opt_revision_t peg_revision;
+	peg_revision.kind = svn_opt_revision_unspecified;
+
+	if (svn_path_is_url (path)) {
+		ra_session_entry *entry;
+		svn_revnum_t rev = revision->kind == svn_opt_revision_number ?
+			revision->value.number : SVN_INVALID_REVNUM;
+		svn_error_t *err;
+
+		SVN_ERR (session_acquire (&entry, client, path, pool));
+		err = SVN_NO_ERROR;
+		if (SVN_IS_VALID_REVNUM (rev)) {
+			err = session_trace (&path, entry->session, entry->root, rev, pool);
+		}
+		if (!err) {
+			err = cached_cat (client, entry, path, "", rev, stream, buffer,
+							  buffer != NULL ? svn_stringbuf_create ("", pool) : NULL, pool);
+		}
+		session_release (client, entry, err);
+		return err;
+	}
+
+	return svn_client_cat2 (stream, path, &peg_revision, revision, client->ctx, pool);
+}
+
+
+static int
+l_cat (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+	
+	svn_stream_t *stream;
+	svn_stringbuf_t *buffer;
+	luaL_Buffer b;
+	svn_opt_revision_t revision;
+
+	const char *path = luaL_checkstring (L, 1);
+
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		revision.kind = get_revision_kind (path);
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
+	}
+
+	init_function (&ctx, &pool, L, 3);
+
+	path = svn_path_canonicalize (path, pool);
+
+	stream = svn_stream_empty (pool);
+
+	/* A file in the repository comes whole in one request and goes to
+	   a buffer. A working copy file is read straight into a Lua
+	   buffer. */
+	if (svn_path_is_url (path)) {
+		buffer = svn_stringbuf_create ("", pool);
+		svn_stream_set_write (stream, write_fn);
+		svn_stream_set_baton (stream, buffer);
+
+		err = cat_path (get_client (L), path, &revision, stream, buffer, pool);
+		IF_ERROR_RETURN (err, pool, L);
+
+		lua_pushlstring (L, buffer->data, buffer->len);
+	} else {
+		luaL_buffinit (L, &b);
+		svn_stream_set_write (stream, buffer_write_fn);
+		svn_stream_set_baton (stream, &b);
+
+		err = cat_path (get_client (L), path, &revision, stream, NULL, pool);
+		IF_ERROR_RETURN (err, pool, L);
+
+		luaL_pushresult (&b);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+/* Size of the chunks handed to Lua by cat_stream and cat_iter */
+#define CAT_CHUNK_SIZE (64 * 1024)
+
+/* Groups the writes to a stream in chunks before handing them to FLUSH */
+typedef struct chunk_bt {
+	svn_stringbuf_t *buffer;
+	svn_error_t *(*flush) (void *baton, const char *data, apr_size_t len);
+	void *baton;
+} chunk_bt;
+
+
+static svn_error_t *
+chunk_write (void *baton, const char *data, apr_size_t *len) {
+	chunk_bt *cb = baton;
+
+	svn_stringbuf_appendbytes (cb->buffer, data, *len);
+
+	if (cb->buffer->len >= CAT_CHUNK_SIZE) {
+		SVN_ERR (cb->flush (cb->baton, cb->buffer->data, cb->buffer->len));
+		svn_stringbuf_setempty (cb->buffer);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+static svn_error_t *
+chunk_close (void *baton) {
+	chunk_bt *cb = baton;
+
+	if (cb->buffer->len > 0) {
+		SVN_ERR (cb->flush (cb->baton, cb->buffer->data, cb->buffer->len));
+		svn_stringbuf_setempty (cb->buffer);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Creates a stream calling FLUSH with chunks of what is written to it.
+   The last chunk is flushed when the stream is closed. */
+static svn_stream_t *
+chunk_stream (svn_error_t *(*flush) (void *, const char *, apr_size_t),
+			  void *baton, apr_pool_t *pool) {
+	chunk_bt *cb = apr_palloc (pool, sizeof (chunk_bt));
+	svn_stream_t *stream = svn_stream_create (cb, pool);
+
+	cb->buffer = svn_stringbuf_create_ensure (CAT_CHUNK_SIZE, pool);
+	cb->flush = flush;
+	cb->baton = baton;
+
+	svn_stream_set_write (stream, chunk_write);
+	svn_stream_set_close (stream, chunk_close);
+	return stream;
+}
+
+
+/* Baton of the operations that hand their results to a Lua function */
+typedef struct callback_bt {
+	lua_State *L;
+	int ifunc;              /* stack index of the function */
+	svn_boolean_t failed;   /* the function raised the error on the top */
+} callback_bt;
+
+
+/* Calls the function of the baton with the NARGS values on the top of
+   the stack. The operation stops when the function returns false. */
+static svn_error_t *
+call_callback (callback_bt *cb, int nargs) {
+	lua_State *L = cb->L;
+	svn_boolean_t stop;
+
+	lua_pushvalue (L, cb->ifunc);
+	lua_insert (L, -(nargs + 1));
+
+	if (lua_pcall (L, nargs, 1, 0) != 0) {
+		cb->failed = TRUE;
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, "Callback failed");
+	}
+
+	stop = lua_isboolean (L, -1) && !lua_toboolean (L, -1);
+	lua_pop (L, 1);
+
+	if (stop) {
+		return svn_error_create (SVN_ERR_CEASE_INVOCATION, NULL, NULL);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Raises the error of a callback, or clears the error of a callback
+   that asked the operation to stop */
+#define IF_CALLBACK_ERROR_RETURN(cb, err, pool, L) do { \
+	if ((cb).failed) { \
+	svn_error_clear (err); \
+	svn_pool_destroy (pool); \
+	return lua_error (L); \
+	} \
+	if (err && svn_error_root_cause (err)->apr_err == SVN_ERR_CEASE_INVOCATION) { \
+	svn_error_clear (err); \
+	err = SVN_NO_ERROR; \
+	} \
+} while (0)
+
+
+static svn_error_t *
+callback_flush (void *baton, const char *data, apr_size_t len) {
+	callback_bt *cb = baton;
+
+	lua_pushlstring (cb->L, data, len);
+	return call_callback (cb, 1);
+}
+
+
+static int
+l_cat_stream (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	svn_stream_t *stream;
+	svn_opt_revision_t revision;
+	callback_bt cb;
+
+	const char *path = luaL_checkstring (L, 1);
+	luaL_checktype (L, 3, LUA_TFUNCTION);
+
+	if (lua_isnil (L, 2)) {
+		revision.kind = get_revision_kind (path);
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
+	}
+
+	init_function (&ctx, &pool, L, 4);
+
+	path = svn_path_canonicalize (path, pool);
+
+	cb.L = L;
+	cb.ifunc = 3;
+	cb.failed = FALSE;
+
+	stream = chunk_stream (callback_flush, &cb, pool);
+
+	err = cat_path (get_client (L), path, &revision, stream, NULL, pool);
+	if (!err) {
+		err = svn_stream_close (stream);
+	}
+	IF_CALLBACK_ERROR_RETURN (cb, err, pool, L);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+/* Size of the write buffer of cat_to */
+#define CAT_TO_BUFFER_SIZE (1024 * 1024)
+
+static int
+l_cat_to (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	apr_file_t *file = NULL;
+	apr_status_t status;
+	apr_os_file_t fd = (apr_os_file_t) -1;
+	svn_stream_t *stream;
+	svn_opt_revision_t revision;
+
+	const char *path = luaL_checkstring (L, 1);
+	const char *dest = NULL;
+	int itable = 4;
+	svn_boolean_t fsync = FALSE;
+
+	if (lua_isnil (L, 2)) {
+		revision.kind = get_revision_kind (path);
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
+	}
+
+	if (lua_type (L, 3) == LUA_TNUMBER) {
+		fd = (apr_os_file_t) lua_tointeger (L, 3);
+	} else {
+		dest = luaL_checkstring (L, 3);
+	}
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getboolfield(L, itable, "fsync", -1, &fsync);
+	}
+
+	init_function (&ctx, &pool, L, itable);
+
+	path = svn_path_canonicalize (path, pool);
+
+	if (dest) {
+		status = apr_file_open (&file, dest,
+				APR_WRITE | APR_CREATE | APR_TRUNCATE | APR_BUFFERED | APR_BINARY,
+				APR_OS_DEFAULT, pool);
+	} else {
+		status = apr_os_file_put (&file, &fd, APR_WRITE | APR_BUFFERED, pool);
+	}
+	if (status) {
+		IF_ERROR_RETURN (svn_error_wrap_apr(status, "Can't open destination file"), pool, L);
+	}
+
+	status = apr_file_buffer_set (file, apr_palloc (pool, CAT_TO_BUFFER_SIZE),
+								  CAT_TO_BUFFER_SIZE);
+	if (status) {
+		IF_ERROR_RETURN (svn_error_wrap_apr(status, "Can't set the file buffer"), pool, L);
+	}
+
+	/* A descriptor given by the caller is left open */
+	stream = svn_stream_from_aprfile2 (file, dest == NULL, pool);
+
+	err = cat_path (get_client (L), path, &revision, stream, NULL, pool);
+
+	if (!err && (status = apr_file_flush (file))) {
+		err = svn_error_wrap_apr (status, "Can't write to destination file");
+	}
+	if (!err && fsync && (status = apr_file_sync (file))) {
+		err = svn_error_wrap_apr (status, "Can't sync destination file");
+	}
+	if (!err) {
+		err = svn_stream_close (stream);
+	}
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+/* Reads the files of the URLs in the array at index 1 in the revision
+   at index 2 over as few sessions as possible: one session serves all
+   the files of a repository and is moved only when the directory
+   changes. The URLs name the files in that revision, they are not
+   traced from HEAD like in cat. Each file takes a single request. The
+   contents go to a table indexed by URL or, when a function is at
+   index 3, to that function. */
+static int
+l_cat_many (lua_State *L) {
+	apr_pool_t *pool;
+	apr_pool_t *iterpool;
+	svn_error_t *err = SVN_NO_ERROR;
+	svn_client_ctx_t *ctx;
+
+	luasvn_client *client;
+	ra_session_entry *entry = NULL;
+	svn_stream_t *stream;
+	svn_stringbuf_t *buffer;
+	svn_stringbuf_t *spool;
+	svn_stringbuf_t *dir;
+	svn_revnum_t rev = SVN_INVALID_REVNUM;
+	callback_bt cb;
+	int i, n;
+
+	int ifunc = 0;
+	svn_revnum_t revision = SVN_INVALID_REVNUM;
+
+	luaL_checktype (L, 1, LUA_TTABLE);
+	n = lua_objlen (L, 1);
+
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti (L, 1, i);
+		luaL_argcheck (L, lua_isstring (L, -1), 1, "URLs must be strings");
+		lua_pop (L, 1);
+	}
+
+	if (!lua_isnoneornil (L, 2)) {
+		revision = lua_tointeger (L, 2);
+	}
+
+	if (!lua_isnoneornil (L, 3)) {
+		luaL_checktype (L, 3, LUA_TFUNCTION);
+		ifunc = 3;
+	}
+
+	init_function (&ctx, &pool, L, 4);
+	client = get_client (L);
+
+	iterpool = svn_pool_create (pool);
+	buffer = svn_stringbuf_create ("", pool);
+	spool = svn_stringbuf_create ("", pool);
+	dir = svn_stringbuf_create ("", pool);
+
+	stream = svn_stream_empty (pool);
+	svn_stream_set_write (stream, write_fn);
+	svn_stream_set_baton (stream, buffer);
+
+	cb.L = L;
+	cb.ifunc = ifunc;
+	cb.failed = FALSE;
+
+	if (ifunc == 0) {
+		lua_newtable (L);
+	}
+
+	for (i = 1; i <= n && !err; i++) {
+		const char *url, *parent, *name;
+
+		svn_pool_clear (iterpool);
+
+		lua_rawgeti (L, 1, i);
+		url = svn_path_canonicalize (lua_tostring (L, -1), iterpool);
+
+		if (!svn_path_is_url (url)) {
+			err = svn_error_createf (SVN_ERR_BAD_URL, NULL, "'%s' is not a URL", url);
+			break;
+		}
+
+		svn_path_split (url, &parent, &name, iterpool);
+
+		if (entry == NULL || !svn_path_is_ancestor (entry->root, url)) {
+			if (entry != NULL) {
+				session_release (client, entry, SVN_NO_ERROR);
+				entry = NULL;
+			}
+			err = session_acquire (&entry, client, parent, pool);
+			if (err) {
+				break;
+			}
+			svn_stringbuf_set (dir, parent);
+
+			/* HEAD is read once for each repository */
+			rev = revision;
+			if (!SVN_IS_VALID_REVNUM (rev)) {
+				err = svn_ra_get_latest_revnum (entry->session, &rev, pool);
+			}
+		} else if (strcmp (dir->data, parent) != 0) {
+			err = svn_ra_reparent (entry->session, parent, iterpool);
+			svn_stringbuf_set (dir, parent);
+		}
+
+		if (!err) {
+			svn_stringbuf_setempty (buffer);
+			err = cached_cat (client, entry, url, svn_path_uri_decode (name, iterpool),
+							  rev, stream, NULL, spool, iterpool);
+		}
+
+		if (err) {
+			break;
+		}
+
+		/* The URL as given is on the top of the stack */
+		lua_pushlstring (L, buffer->data, buffer->len);
+		if (ifunc != 0) {
+			err = call_callback (&cb, 2);
+		} else {
+			lua_settable (L, -3);
+		}
+	}
+
+	if (entry != NULL) {
+		session_release (client, entry, err);
+	}
+	IF_CALLBACK_ERROR_RETURN (cb, err, pool, L);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return ifunc != 0 ? 0 : 1;
+}
+
+
+/* An item waiting in the queue of a producer */
+typedef struct queue_item {
+	struct queue_item *next;
+	apr_pool_t *pool;       /* pool owning the data, or NULL */
+	void *data;
+	apr_size_t len;
+} queue_item;
+
+
+/* A worker thread that runs an operation with its own context and
+   hands the results, through a bounded queue, to an iterator in the
+   Lua thread */
+typedef struct producer_t {
+	apr_pool_t *pool;
+	apr_thread_t *thread;
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;
+
+	luasvn_client_opts opts;
+	svn_error_t *(*run) (struct producer_t *p, svn_client_ctx_t *ctx, apr_pool_t *pool);
+	int (*push) (lua_State *L, struct producer_t *p, queue_item *item);
+	void *baton;
+
+	queue_item *head;
+	queue_item *tail;
+	int nitems;
+	int max_items;
+
+	svn_boolean_t finished;
+	svn_boolean_t cancelled;
+	apr_time_t deadline;        /* or 0 */
+	cancel_token_t *token;      /* or NULL, kept in the environment */
+	svn_error_t *err;
+} producer_t;
+
+#define LUASVN_PRODUCER "luasvn.producer"
+#define PRODUCER_MAX_ITEMS 16
+
+/* How often a worker waiting on a full queue looks at its token */
+#define PRODUCER_POLL (100 * 1000)
+
+
+static svn_boolean_t
+producer_token_cancelled (producer_t *p) {
+	return p->token != NULL && apr_atomic_read32 (&p->token->cancelled) != 0;
+}
+
+
+static void
+free_item (queue_item *item) {
+	if (item->pool != NULL) {
+		svn_pool_destroy (item->pool);
+	}
+	free (item);
+}
+
+
+/* Adds ITEM to the queue, waiting while the queue is full. Fails when
+   the iterator went away. */
+static svn_error_t *
+producer_put (producer_t *p, queue_item *item) {
+	apr_thread_mutex_lock (p->mutex);
+
+	while (p->nitems >= p->max_items && !p->cancelled && !producer_token_cancelled (p)) {
+		if (p->token != NULL) {
+			apr_thread_cond_timedwait (p->cond, p->mutex, PRODUCER_POLL);
+		} else {
+			apr_thread_cond_wait (p->cond, p->mutex);
+		}
+	}
+
+	if (p->cancelled || producer_token_cancelled (p)) {
+		apr_thread_mutex_unlock (p->mutex);
+		free_item (item);
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, NULL);
+	}
+
+	item->next = NULL;
+	if (p->tail != NULL) {
+		p->tail->next = item;
+	} else {
+		p->head = item;
+	}
+	p->tail = item;
+	p->nitems++;
+
+	apr_thread_cond_broadcast (p->cond);
+	apr_thread_mutex_unlock (p->mutex);
+	return SVN_NO_ERROR;
+}
+
+
+static svn_error_t *
+producer_cancel (void *baton) {
+	producer_t *p = baton;
+	svn_boolean_t cancelled;
+
+	apr_thread_mutex_lock (p->mutex);
+	cancelled = p->cancelled;
+	apr_thread_mutex_unlock (p->mutex);
+
+	if (cancelled) {
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, NULL);
+	}
+	if (producer_token_cancelled (p)) {
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, "Operation cancelled");
+	}
+	if (p->deadline != 0 && apr_time_now () > p->deadline) {
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, "Operation timed out");
+	}
+	return SVN_NO_ERROR;
+}
+
+
+static void * APR_THREAD_FUNC
+producer_main (apr_thread_t *thread, void *data) {
+	producer_t *p = data;
+	svn_client_ctx_t *ctx;
+	svn_error_t *err;
+	apr_pool_t *pool = create_pool ();
+
+	if (pool == NULL) {
+		err = svn_error_create (APR_ENOMEM, NULL, "Error creating allocator");
+	} else {
+		err = create_context (&ctx, &p->opts, pool);
+		if (!err) {
+			ctx->cancel_func = producer_cancel;
+			ctx->cancel_baton = p;
+			err = p->run (p, ctx, pool);
+		}
+	}
+
+	apr_thread_mutex_lock (p->mutex);
+	p->finished = TRUE;
+	p->err = err;
+	apr_thread_cond_broadcast (p->cond);
+	apr_thread_mutex_unlock (p->mutex);
+
+	if (pool != NULL) {
+		svn_pool_destroy (pool);
+	}
+
+	apr_thread_exit (thread, APR_SUCCESS);
+	return NULL;
+}
+
+
+static void
+producer_join (producer_t *p) {
+	apr_status_t status;
+
+	if (p->thread != NULL) {
+		apr_thread_join (&status, p->thread);
+		p->thread = NULL;
+	}
+}
+
+
+/* Stops the worker at once, waits for it and frees the producer. It is
+   both the close method and the finalizer. */
+static int
+producer_close (lua_State *L) {
+	producer_t *p = luaL_checkudata (L, 1, LUASVN_PRODUCER);
+
+	if (p->pool == NULL) {
+		return 0;
+	}
+
+	if (p->mutex != NULL) {
+		apr_thread_mutex_lock (p->mutex);
+		p->cancelled = TRUE;
+		apr_thread_cond_broadcast (p->cond);
+		apr_thread_mutex_unlock (p->mutex);
+	}
+
+	producer_join (p);
+
+	while (p->head != NULL) {
+		queue_item *item = p->head;
+		p->head = item->next;
+		free_item (item);
+	}
+
+	svn_error_clear (p->err);
+	svn_pool_destroy (p->pool);
+	p->pool = NULL;
+	return 0;
+}
+
+
+/* Iterator reading the results of the producer in the first upvalue */
+static int
+producer_next (lua_State *L) {
+	producer_t *p = luaL_checkudata (L, lua_upvalueindex (1), LUASVN_PRODUCER);
+	queue_item *item;
+	svn_error_t *err;
+	apr_pool_t *pool;
+	int n;
+
+	if (p->pool == NULL) {
+		return 0;
+	}
+
+	/* Results already read ahead are dropped too */
+	if (producer_token_cancelled (p)) {
+		apr_thread_mutex_lock (p->mutex);
+		p->cancelled = TRUE;
+		apr_thread_cond_broadcast (p->cond);
+		apr_thread_mutex_unlock (p->mutex);
+		producer_join (p);
+
+		pool = svn_pool_create (p->pool);
+		IF_ERROR_RETURN (svn_error_create (SVN_ERR_CANCELLED, NULL, "Operation cancelled"),
+						 pool, L);
+	}
+
+	apr_thread_mutex_lock (p->mutex);
+
+	while (p->head == NULL && !p->finished) {
+		apr_thread_cond_wait (p->cond, p->mutex);
+	}
+
+	item = p->head;
+	if (item != NULL) {
+		p->head = item->next;
+		if (p->head == NULL) {
+			p->tail = NULL;
+		}
+		p->nitems--;
+		apr_thread_cond_broadcast (p->cond);
+	}
+
+	apr_thread_mutex_unlock (p->mutex);
+
+	if (item != NULL) {
+		n = p->push (L, p, item);
+		free_item (item);
+		return n;
+	}
+
+	producer_join (p);
+
+	err = p->err;
+	p->err = NULL;
+	if (err) {
+		pool = svn_pool_create (p->pool);
+		IF_ERROR_RETURN (err, pool, L);
+	}
+	return 0;
+}
+
+
+/* Pushes a new producer that will run RUN in a worker thread with a
+   copy of the options of the client */
+static producer_t *
+new_producer (lua_State *L, luasvn_client *client,
+			  svn_error_t *(*run) (producer_t *, svn_client_ctx_t *, apr_pool_t *),
+			  int (*push) (lua_State *, producer_t *, queue_item *)) {
+	producer_t *p = lua_newuserdata (L, sizeof (producer_t));
+
+	memset (p, 0, sizeof (producer_t));
+	luaL_getmetatable (L, LUASVN_PRODUCER);
+	lua_setmetatable (L, -2);
+
+	p->pool = create_pool ();
+	if (p->pool == NULL) {
+		send_error (L, "Error creating allocator\n");
+	}
+
+	if (apr_thread_mutex_create (&p->mutex, APR_THREAD_MUTEX_DEFAULT, p->pool)
+			|| apr_thread_cond_create (&p->cond, p->pool)) {
+		send_error (L, "Error creating the worker thread\n");
+	}
+
+	p->opts.config_dir = apr_pstrdup (p->pool, client->opts.config_dir);
+	p->opts.username = apr_pstrdup (p->pool, client->opts.username);
+	p->opts.password = apr_pstrdup (p->pool, client->opts.password);
+	p->opts.no_auth_cache = client->opts.no_auth_cache;
+	p->opts.trust_server_cert = client->opts.trust_server_cert;
+	/* A worker thread must never prompt */
+	p->opts.non_interactive = TRUE;
+
+	p->run = run;
+	p->push = push;
+	p->max_items = PRODUCER_MAX_ITEMS;
+	return p;
+}
+
+
+/* Gives TOKEN, the cancel option of the table at ITABLE, to the
+   producer on the top of the stack, which keeps it alive in its
+   environment while the worker runs */
+static void
+producer_set_token (lua_State *L, producer_t *p, int itable, cancel_token_t *token) {
+	if (token == NULL) {
+		return;
+	}
+
+	lua_createtable (L, 1, 0);
+	lua_getfield (L, itable, "cancel");
+	lua_rawseti (L, -2, 1);
+	lua_setfenv (L, -2);
+	p->token = token;
+}
+
+
+/* Starts the producer on the top of the stack and replaces it by its
+   iterator and the producer, the state of the loop. A loop that exits
+   early must call close on the state to stop the worker at once;
+   otherwise it waits for the garbage collector:
+
+     local next, it = svn.log_iter (url)
+     for rev, entry in next, it do ... end
+     it:close () */
+static int
+start_producer (lua_State *L, producer_t *p) {
+	if (apr_thread_create (&p->thread, NULL, producer_main, p, p->pool)) {
+		p->thread = NULL;
+		return send_error (L, "Error creating the worker thread\n");
+	}
+
+	lua_pushvalue (L, -1);
+	lua_pushcclosure (L, producer_next, 1);
+	lua_insert (L, -2);
+	return 2;
+}
+
+
+static const struct luaL_Reg producer_methods [] = {
+	{"close", producer_close},
+	{NULL, NULL}
+};
+
+
+typedef struct cat_producer_bt {
+	const char *path;
+	svn_opt_revision_t revision;
+} cat_producer_bt;
+
+
+static svn_error_t *
+cat_producer_flush (void *baton, const char *data, apr_size_t len) {
+	queue_item *item = malloc (sizeof (queue_item) + len);
+
+	if (item == NULL) {
+		return svn_error_create (APR_ENOMEM, NULL, NULL);
+	}
+
+	item->pool = NULL;
+	item->data = item + 1;
+	item->len = len;
+	memcpy (item->data, data, len);
+
+	return producer_put (baton, item);
+}
+
+
+static svn_error_t *
+cat_producer_run (producer_t *p, svn_client_ctx_t *ctx, apr_pool_t *pool) {
+	cat_producer_bt *bt = p->baton;
+	svn_stream_t *stream = chunk_stream (cat_producer_flush, p, pool);
+	svn_opt_revision_t peg_revision;
+
+	if (svn_path_is_url (bt->path)) {
+		svn_ra_session_t *session;
+		const char *url = bt->path;
+		svn_revnum_t rev = SVN_INVALID_REVNUM;
+
+		SVN_ERR (svn_client_open_ra_session (&session, url, ctx, pool));
+		if (bt->revision.kind == svn_opt_revision_number) {
+			const char *root;
+
+			rev = bt->revision.value.number;
+			SVN_ERR (svn_ra_get_repos_root (session, &root, pool));
+			SVN_ERR (session_trace (&url, session, root, rev, pool));
+		}
+		SVN_ERR (session_cat (session, url, "", rev, stream, NULL, pool));
+	} else {
+		peg_revision.kind = svn_opt_revision_unspecified;
+		SVN_ERR (svn_client_cat2 (stream, bt->path, &peg_revision, &bt->revision, ctx, pool));
+	}
+
+	return svn_stream_close (stream);
+}
+
+
+static int
+cat_producer_push (lua_State *L, producer_t *p, queue_item *item) {
+	lua_pushlstring (L, item->data, item->len);
+	return 1;
+}
+
+
+static int
+l_cat_iter (lua_State *L) {
+	producer_t *p;
+	cat_producer_bt *bt;
+	svn_opt_revision_t revision;
+	cancel_token_t *token;
+	apr_time_t deadline;
+
+	const char *path = luaL_checkstring (L, 1);
+	luasvn_client *client = get_client (L);
+
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		revision.kind = get_revision_kind (path);
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
+	}
+
+	getcancelfields (L, 3, client, &deadline, &token);
+
+	p = new_producer (L, client, cat_producer_run, cat_producer_push);
+	p->deadline = deadline;
+	producer_set_token (L, p, 3, token);
+
+	bt = apr_palloc (p->pool, sizeof (cat_producer_bt));
+	bt->path = svn_path_canonicalize (path, p->pool);
+	bt->revision = revision;
+	p->baton = bt;
+
+	return start_producer (L, p);
+}
+
+
+static int
+l_checkout (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	svn_opt_revision_t revision;
+	svn_opt_revision_t peg_revision;
+	svn_revnum_t rev;
+
+	const char *path = luaL_checkstring (L, 1);
+	const char *dir = luaL_checkstring (L, 2);
+	int itable = 4;
+	svn_depth_t depth = svn_depth_infinity;
+	svn_boolean_t ignore_externals = FALSE;
+	svn_boolean_t obstructions = FALSE;
+	peg_revision.kind = svn_opt_revision_unspecified;
+
+	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
+		revision.kind = svn_opt_revision_head;	
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 3);
+	}
+	
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
+		getboolfield(L, itable, "allow_obstructions", -1, &obstructions);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	path = svn_path_canonicalize (path, pool);
+	dir = svn_path_canonicalize (dir, pool);
+	
+	err = svn_client_checkout3 (&rev, path, dir, &peg_revision, &revision, depth,
+								ignore_externals, obstructions, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);
+	
+	lua_pushinteger (L, rev);
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_cleanup (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
+
+	init_function (&ctx, &pool, L, 2);
+	
+	path = svn_path_canonicalize (path, pool);
+
+	err = svn_client_cleanup (path, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);
+	
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+static int
+l_commit (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	apr_array_header_t *array;
+
+	const char *message = (lua_gettop (L) < 2 || lua_isnil (L, 2)) ? "" : luaL_checkstring (L, 2);
+	int itable = 3;
+	svn_depth_t depth = svn_depth_infinity;
+	svn_boolean_t keep_locks = FALSE;
+	svn_commit_info_t *commit_info = NULL;
+	
+	if (!lua_isnoneornil (L, 1)) {
+		checkpaths (L, 1);
+	}
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "keep_locks", -1, &keep_locks);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	if (lua_isnoneornil (L, 1)) {
+		array = apr_array_make (pool, 1, sizeof (const char *));
+		APR_ARRAY_PUSH (array, const char *) = "";
+	} else {
+		array = getpatharray (L, 1, pool);
+	}
+
+	make_log_msg_baton (&(ctx->log_msg_baton2), message,
+						APR_ARRAY_IDX (array, 0, const char *), ctx->config, pool, L);
+	
+	ctx->log_msg_func2 = log_msg_func2;
+
+	err = svn_client_commit4 (&commit_info, array, depth, keep_locks,
+							  FALSE, NULL, NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);	
+
+	if (commit_info == NULL) {
+		lua_pushnil (L);
+	} else {
+		lua_pushinteger (L, commit_info->revision);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_copy (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+	
+	apr_array_header_t *arraysource;
+	apr_array_header_t *paths;
+	svn_opt_revision_t revision;
+	int i;
+
+	const char *dest_path = luaL_checkstring (L, 2);
+	const char *message = NULL;
+	int itable = 5;
+	svn_commit_info_t *commit_info = NULL;
+	svn_boolean_t child = FALSE;
+	svn_boolean_t parents = FALSE;
+	svn_boolean_t ignore_externals = FALSE;
+
+	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
+		revision.kind = svn_opt_revision_unspecified;
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 3);
+	}	
+
+	message = (lua_gettop (L) < 4 || lua_isnil (L, 4)) ? "" : luaL_checkstring (L, 4);
+
+	checkpaths (L, 1);
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getboolfield(L, itable, "copy_as_child", -1, &child);
+		getboolfield(L, itable, "make_parents", -1, &parents);
+		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	paths = getpatharray (L, 1, pool);
+	dest_path = svn_path_canonicalize (dest_path, pool);
+
+	/* Many sources are copied, in one commit, into the destination */
+	arraysource = apr_array_make(pool, paths->nelts, sizeof(const svn_client_copy_source_t *));
+	for (i = 0; i < paths->nelts; i++) {
+		svn_client_copy_source_t *copy_source = apr_palloc (pool, sizeof (*copy_source));
+		copy_source->path = APR_ARRAY_IDX (paths, i, const char *);
+		copy_source->revision = &revision;
+		copy_source->peg_revision = &revision;
+		APR_ARRAY_PUSH(arraysource, const svn_client_copy_source_t *) = copy_source;
+	}
+	if (paths->nelts > 1) {
+		child = TRUE;
+	}
+
+	if (svn_path_is_url (dest_path)) {
+		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
+		ctx->log_msg_func2 = log_msg_func2;
+	}
+
+	err = svn_client_copy5 (&commit_info, arraysource, dest_path, child, parents,
+		   					ignore_externals, NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);	
+
+	if (commit_info == NULL) {
+		lua_pushnil (L);
+	} else {
+		lua_pushinteger (L, commit_info->revision);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_delete (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	apr_array_header_t *array;
+	
+	const char *message = (lua_gettop (L) < 2 || lua_isnil (L, 2)) ? "" : luaL_checkstring (L, 2);
+	int itable = 3;
+	svn_boolean_t force = FALSE;
+	svn_boolean_t keep_local = FALSE;
+	svn_commit_info_t *commit_info = NULL;
+
+	checkpaths (L, 1);
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getboolfield(L, itable, "force", -1, &force);
+		getboolfield(L, itable, "keep_local", -1, &keep_local);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	array = getpatharray (L, 1, pool);
+
+	if (svn_path_is_url (APR_ARRAY_IDX (array, 0, const char *))) {
+		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
+		ctx->log_msg_func2 = log_msg_func2;
+	}
+
+	err = svn_client_delete3 (&commit_info, array, force, keep_local, NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	if (commit_info == NULL) {
+		lua_pushnil (L);
+	} else {
+		lua_pushinteger (L, commit_info->revision);
+	}
+	
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_diff (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	apr_file_t *aprout;
+	apr_file_t *aprerr;
+	apr_status_t status;
+	apr_array_header_t *array;
+	svn_opt_revision_t rev1;
+	svn_opt_revision_t rev2;
+
+	const char *path1 = NULL;
+	const char *path2 = NULL;
+	const char *outfile = NULL;	
+	const char *errfile = NULL;
+	int itable = 7;
+	svn_depth_t depth = svn_depth_infinity;
+	svn_boolean_t ignore_ancestry = TRUE;
+	svn_boolean_t no_diff_deleted = FALSE;
+	svn_boolean_t force = FALSE;
+	
+	path1 = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
+		
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		rev1.kind = get_revision_kind (path1);
+	} else {
+		rev1.kind = svn_opt_revision_number;
+		rev1.value.number = lua_tointeger (L, 2);
+	}
+	
+	path2 = (lua_gettop (L) < 3 || lua_isnil (L, 3)) ? path1 : luaL_checkstring (L, 3);
+
+	if (lua_gettop (L) < 4 || lua_isnil (L, 4)) {
+		if (svn_path_is_url (path2)) {
+			rev2.kind = svn_opt_revision_head;
+		} else {
+			rev2.kind = svn_opt_revision_working;
+		}
+	} else {
+		rev2.kind = svn_opt_revision_number;
+		rev2.value.number = lua_tointeger (L, 4);
+	}
+
+	outfile = (lua_gettop (L) < 5 || lua_isnil (L, 5)) ? NULL : luaL_checkstring (L, 5);
+	
+	errfile = (lua_gettop (L) < 6 || lua_isnil (L, 6)) ? NULL : luaL_checkstring (L, 6);
+	
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "ignore_ancestry", -1, &ignore_ancestry);
+		getboolfield(L, itable, "no_diff_deleted", -1, &no_diff_deleted);
+		getboolfield(L, itable, "force", -1, &force);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	path1 = svn_path_canonicalize (path1, pool);
+	path2 = svn_path_canonicalize (path2, pool);
+
+	if (outfile) {
+		status = apr_file_open (&aprout, outfile, APR_READ | APR_WRITE | APR_CREATE,
+				                APR_OS_DEFAULT, pool);
+	} else {
+		status = apr_file_open_stdout(&aprout, pool);
+	}
+	if (status) {
+		IF_ERROR_RETURN (svn_error_wrap_apr(status, "Can't open output file"), pool, L);
+	}
+
+	if (errfile) {
+		status = apr_file_open (&aprerr, errfile, APR_READ | APR_WRITE | APR_CREATE,
+				                APR_OS_DEFAULT, pool);
+	} else {
+		status = apr_file_open_stderr(&aprerr, pool);
+	}
+	if (status) {
+		IF_ERROR_RETURN (svn_error_wrap_apr(status, "Can't open error file"), pool , L);
+	}
+
+	array = apr_array_make (pool, 0, sizeof (const char *));
+
+	err = svn_client_diff4 (array, path1, &rev1, path2, &rev2, NULL,
+			                depth, ignore_ancestry, no_diff_deleted, force,
+							APR_LOCALE_CHARSET, aprout, aprerr, NULL,
+							ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);	
+
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+static int
+l_import (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+	
+	const char *path = lua_isnil (L, 1) ? "" : luaL_checkstring (L, 1);
+	const char *url = luaL_checkstring (L, 2);
+	const char *message = (lua_gettop (L) < 3 || lua_isnil (L, 3)) ? "" : luaL_checkstring (L, 3);
 	int itable = 4;
 	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t ignore_externals = FALSE;
-	svn_boolean_t obstructions = FALSE;
+	svn_boolean_t no_ignore = FALSE;
+	svn_boolean_t ignore_unknown = FALSE;
+	svn_commit_info_t *commit_info = NULL;
+	
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "no_ignore", -1, &no_ignore);
+		getboolfield(L, itable, "ignore_unknown_node_types", -1, &ignore_unknown);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	path = svn_path_canonicalize (path, pool);
+	url = svn_path_canonicalize (url, pool);
+
+	make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
+	ctx->log_msg_func2 = log_msg_func2;
+
+	err = svn_client_import3 (&commit_info, path, url, depth, no_ignore, ignore_unknown,
+							  NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	if (commit_info == NULL) {
+		lua_pushnil (L);
+	} else {
+		lua_pushinteger (L, commit_info->revision);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+/* How list and log give times: as the strings they always gave, or as
+   numbers, in microseconds or in seconds, since the epoch */
+enum time_format {
+	time_string,
+	time_usec,
+	time_seconds
+};
+
+
+/* Reads the time option of the table at ITABLE, "usec" or "seconds" */
+static void
+gettimefield (lua_State *L, int itable, enum time_format *format) {
+	const char *s;
+
+	lua_getfield (L, itable, "time");
+	s = lua_tostring (L, -1);
+	if (s != NULL) {
+		if (strcmp (s, "usec") == 0) {
+			*format = time_usec;
+		} else if (strcmp (s, "seconds") == 0) {
+			*format = time_seconds;
+		} else {
+			luaL_error (L, "unknown time format '%s'", s);
+		}
+	}
+	lua_pop (L, 1);
+}
+
+
+/* Pushes T in FORMAT, which is not time_string */
+static void
+push_time (lua_State *L, apr_time_t t, enum time_format format) {
+	if (format == time_seconds) {
+		lua_pushnumber (L, (lua_Number) t / APR_USEC_PER_SEC);
+	} else {
+		lua_pushnumber (L, (lua_Number) t);
+	}
+}
+
+
+typedef struct list_bt {
+	lua_State *L;
+	callback_bt *cb;        /* function given to list_each, or NULL */
+	apr_uint32_t fields;    /* SVN_DIRENT_* of the entries */
+	enum time_format time;
+} list_bt;
+
+
+/* Arguments of a list request */
+typedef struct list_args {
+	const char *path;
+	svn_opt_revision_t revision;
+	svn_depth_t depth;
+	svn_boolean_t fetch_locks;
+	apr_uint32_t fields;    /* SVN_DIRENT_* asked to the server */
+	enum time_format time;
+} list_args;
+
+
+/* Names of the fields of the entries of list */
+static const struct {
+	const char *name;
+	apr_uint32_t field;
+} list_fields [] = {
+	{"author", SVN_DIRENT_LAST_AUTHOR},
+	{"date", SVN_DIRENT_TIME},
+	{"has_props", SVN_DIRENT_HAS_PROPS},
+	{"revision", SVN_DIRENT_CREATED_REV},
+	{"size", SVN_DIRENT_SIZE},
+	{NULL, 0}
+};
+
+
+/* Reads the array of field names at the top of the stack. The kind is
+   always asked for, as it names the entries. */
+static apr_uint32_t
+getlistfields (lua_State *L) {
+	apr_uint32_t fields = SVN_DIRENT_KIND;
+	int i, j, n;
+
+	if (!lua_istable (L, -1)) {
+		luaL_error (L, "fields must be an array of names");
+	}
+	n = lua_objlen (L, -1);
+
+	for (i = 1; i <= n; i++) {
+		const char *name;
+
+		lua_rawgeti (L, -1, i);
+		name = lua_tostring (L, -1);
+		for (j = 0; list_fields[j].name != NULL; j++) {
+			if (name != NULL && strcmp (name, list_fields[j].name) == 0) {
+				break;
+			}
+		}
+		if (list_fields[j].name == NULL) {
+			luaL_error (L, "unknown list field '%s'", name != NULL ? name : "?");
+		}
+		fields |= list_fields[j].field;
+		lua_pop (L, 1);
+	}
+	return fields;
+}
+
+
+/* Reads the path and the revision of a list request, and its options
+   from the table at ITABLE */
+static void
+get_list_args (lua_State *L, int itable, list_args *args) {
+	args->path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
+	args->depth = svn_depth_immediates;
+	args->fetch_locks = FALSE;
+	args->fields = SVN_DIRENT_ALL;
+	args->time = time_string;
+
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		args->revision.kind = get_revision_kind (args->path);
+	} else {
+		args->revision.kind = svn_opt_revision_number;
+		args->revision.value.number = lua_tointeger (L, 2);
+	}
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &args->depth);
+		getboolfield(L, itable, "fetch_locks", -1, &args->fetch_locks);
+
+		lua_getfield (L, itable, "fields");
+		if (!lua_isnil (L, -1)) {
+			args->fields = getlistfields (L);
+		}
+		lua_pop (L, 1);
+
+		gettimefield (L, itable, &args->time);
+	}
+}
+
+
+/* Gets the name list gives to the entry PATH, or NULL for the listed
+   directory itself */
+static const char *
+list_entry_name (const char *path, const svn_dirent_t *dirent,
+				 const char *abs_path, apr_pool_t *pool) {
+	if (strcmp (path, "") == 0) {
+		if (dirent->kind != svn_node_file) {
+			return NULL;
+		}
+		path = svn_path_basename (abs_path, pool);
+	}
+
+	if (dirent->kind == svn_node_dir) {
+		return apr_pstrcat (pool, path, "/", NULL);
+	}
+	return apr_pstrdup (pool, path);
+}
+
+
+/* Pushes the table describing DIRENT, with the FIELDS that were asked.
+   has_props is only given when it is asked by name. */
+static void
+push_dirent (lua_State *L, const svn_dirent_t *dirent, apr_uint32_t fields,
+			 enum time_format time, apr_pool_t *pool) {
+	lua_createtable (L, 0, 4);
+	
+	if ((fields & SVN_DIRENT_SIZE) && dirent->kind == svn_node_file) {
+		lua_pushinteger (L, dirent->size);
+		lua_setfield (L, -2, "size");
+	}
+
+	if ((fields & SVN_DIRENT_LAST_AUTHOR) && dirent->last_author) {
+		lua_pushstring (L, dirent->last_author);
+		lua_setfield (L, -2, "author");
+	}
+	
+	if (fields & SVN_DIRENT_CREATED_REV) {
+		lua_pushinteger (L, dirent->created_rev);
+		lua_setfield (L, -2, "revision");
+	}
+
+	if (fields & SVN_DIRENT_TIME) {
+		if (time == time_string) {
+			lua_pushstring (L, svn_time_to_human_cstring (dirent->time, pool));
+		} else {
+			push_time (L, dirent->time, time);
+		}
+		lua_setfield (L, -2, "date");
+	}
+
+	if (fields != SVN_DIRENT_ALL && (fields & SVN_DIRENT_HAS_PROPS)) {
+		lua_pushboolean (L, dirent->has_props);
+		lua_setfield (L, -2, "has_props");
+	}
+}
+
+
+static svn_error_t *
+list_func (void *baton,
+		   const char *path,
+		   const svn_dirent_t *dirent,
+		   const svn_lock_t *lock,
+		   const char *abs_path,
+		   apr_pool_t *pool)
+{
+	list_bt *lb = baton;
+	lua_State *L = lb->L;
+	const char *name = list_entry_name (path, dirent, abs_path, pool);
+
+	if (name == NULL) {
+		return SVN_NO_ERROR;
+	}
+
+	lua_pushstring (L, name);
+	push_dirent (L, dirent, lb->fields, lb->time, pool);
+
+	if (lb->cb != NULL) {
+		return call_callback (lb->cb, 2);
+	}
+
+	lua_settable (L, -3);
+
+	return SVN_NO_ERROR;
+}
+
+
+/* An entry of a cached listing, as given to the list function */
+typedef struct list_cache_item {
+	const char *path;
+	const char *abs_path;
+	svn_dirent_t *dirent;
+} list_cache_item;
+
+
+static void
+list_cache_unlink (luasvn_client *client, list_cache_entry *e) {
+	apr_hash_set (client->list_cache.entries, e->key, APR_HASH_KEY_STRING, NULL);
+
+	if (e->prev != NULL) {
+		e->prev->next = e->next;
+	} else {
+		client->list_cache.head = e->next;
+	}
+	if (e->next != NULL) {
+		e->next->prev = e->prev;
+	} else {
+		client->list_cache.tail = e->prev;
+	}
+	e->prev = e->next = NULL;
+}
+
+
+/* Drops the least recently used listings until the cache holds at most
+   MAX_ENTRIES */
+static void
+list_cache_trim (luasvn_client *client, int max_entries) {
+	while (client->list_cache.tail != NULL
+			&& (int) apr_hash_count (client->list_cache.entries) > max_entries) {
+		list_cache_entry *e = client->list_cache.tail;
+
+		list_cache_unlink (client, e);
+		svn_pool_destroy (e->pool);
+		client->list_cache.evicted++;
+	}
+}
+
+
+/* Adds E as the most recently used listing, in place of the listing of
+   the same key if there is one */
+static void
+list_cache_insert (luasvn_client *client, list_cache_entry *e) {
+	list_cache_entry *old;
+
+	if (client->list_cache.entries == NULL) {
+		client->list_cache.entries = apr_hash_make (client->pool);
+	}
+
+	old = apr_hash_get (client->list_cache.entries, e->key, APR_HASH_KEY_STRING);
+	if (old != NULL) {
+		list_cache_unlink (client, old);
+		svn_pool_destroy (old->pool);
+	}
+
+	e->prev = NULL;
+	e->next = client->list_cache.head;
+	if (e->next != NULL) {
+		e->next->prev = e;
+	} else {
+		client->list_cache.tail = e;
+	}
+	client->list_cache.head = e;
+	apr_hash_set (client->list_cache.entries, e->key, APR_HASH_KEY_STRING, e);
+
+	list_cache_trim (client, client->list_cache.max_entries);
+}
+
+
+/* Keeps the entries of a listing while handing them to FUNC */
+typedef struct list_fill_bt {
+	list_cache_entry *entry;
+	svn_client_list_func_t func;
+	void *baton;
+} list_fill_bt;
+
+
+static svn_error_t *
+list_fill_func (void *baton,
+				const char *path,
+				const svn_dirent_t *dirent,
+				const svn_lock_t *lock,
+				const char *abs_path,
+				apr_pool_t *pool)
+{
+	list_fill_bt *fb = baton;
+	apr_pool_t *epool = fb->entry->pool;
+	list_cache_item *item = apr_array_push (fb->entry->items);
+
+	item->path = apr_pstrdup (epool, path);
+	item->abs_path = apr_pstrdup (epool, abs_path);
+	item->dirent = svn_dirent_dup (dirent, epool);
+
+	return fb->func (fb->baton, path, dirent, lock, abs_path, pool);
+}
+
+
+/* Lists ARGS like svn_client_list2, handing the entries to FUNC, through
+   the list cache of CLIENT when it is enabled. A listing is kept under
+   the last changed revision of the directory, which changes with
+   anything below it, so one stat tells whether a listing is still the
+   same. Listings with locks are not cached, as locks change without new
+   revisions. */
+static svn_error_t *
+cached_list (const list_args *args, svn_client_list_func_t func, void *baton,
+			 luasvn_client *client, apr_pool_t *pool) {
+	svn_opt_revision_t peg_revision;
+	svn_opt_revision_t revision = args->revision;
+	ra_session_entry *entry;
+	svn_dirent_t *dirent = NULL;
+	list_cache_entry *e = NULL;
+	svn_revnum_t rev;
+	apr_pool_t *iterpool;
+	list_fill_bt fb;
+	svn_error_t *err;
+	const char *key;
+	int i;
+
+	peg_revision.kind = svn_opt_revision_unspecified;
+
+	if (client->list_cache.max_entries > 0 && svn_path_is_url (args->path)
+			&& !args->fetch_locks) {
+		SVN_ERR (session_acquire (&entry, client, args->path, pool));
+		err = session_revnum (&rev, entry->session, &args->revision, pool);
+		if (!err) {
+			err = svn_ra_stat (entry->session, "", rev, &dirent, pool);
+		}
+		session_release (client, entry, err);
+		SVN_ERR (err);
+
+		/* HEAD is pinned to the revision that was checked, so that a
+		   commit in between cannot store a newer listing under it */
+		if (revision.kind != svn_opt_revision_number) {
+			revision.kind = svn_opt_revision_number;
+			revision.value.number = rev;
+			peg_revision = revision;
+		}
+	}
+
+	/* Not cached, or not found: the listing gives the error */
+	if (dirent == NULL) {
+		return svn_client_list2 (args->path, &peg_revision, &args->revision, args->depth,
+								 args->fields, args->fetch_locks, func, baton,
+								 client->ctx, pool);
+	}
+
+	key = apr_psprintf (pool, "%s:%ld:%d:%x", args->path, dirent->created_rev, args->depth,
+						args->fields);
+
+	if (client->list_cache.entries != NULL) {
+		e = apr_hash_get (client->list_cache.entries, key, APR_HASH_KEY_STRING);
+	}
+
+	if (e == NULL) {
+		apr_pool_t *epool = svn_pool_create (client->pool);
+
+		client->list_cache.misses++;
+
+		e = apr_pcalloc (epool, sizeof (list_cache_entry));
+		e->pool = epool;
+		e->key = apr_pstrdup (e->pool, key);
+		e->items = apr_array_make (e->pool, 16, sizeof (list_cache_item));
+
+		fb.entry = e;
+		fb.func = func;
+		fb.baton = baton;
+
+		err = svn_client_list2 (args->path, &peg_revision, &revision, args->depth,
+								args->fields, FALSE, list_fill_func, &fb,
+								client->ctx, pool);
+		if (err) {
+			svn_pool_destroy (e->pool);
+			return err;
+		}
+
+		list_cache_insert (client, e);
+		return SVN_NO_ERROR;
+	}
+
+	client->list_cache.hits++;
+
+	/* Out of the cache while FUNC runs, which may list as well */
+	list_cache_unlink (client, e);
+
+	iterpool = svn_pool_create (pool);
+	err = SVN_NO_ERROR;
+	for (i = 0; i < e->items->nelts && !err; i++) {
+		list_cache_item *item = &APR_ARRAY_IDX (e->items, i, list_cache_item);
+
+		svn_pool_clear (iterpool);
+		err = func (baton, item->path, item->dirent, NULL, item->abs_path, iterpool);
+	}
+	svn_pool_destroy (iterpool);
+
+	list_cache_insert (client, e);
+	return err;
+}
+
+
+/* Lists PATH, with the options at ITABLE, into a table or, when IFUNC
+   is not 0, through the function at IFUNC */
+static int
+list_path (lua_State *L, int itable, int ifunc) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	list_args args;
+	list_bt lb;
+	callback_bt cb;
+
+	get_list_args (L, itable, &args);
+
+	init_function (&ctx, &pool, L, itable);
+	args.path = svn_path_canonicalize (args.path, pool);
+
+	lb.L = L;
+	lb.cb = NULL;
+	lb.fields = args.fields;
+	lb.time = args.time;
+	cb.L = L;
+	cb.ifunc = ifunc;
+	cb.failed = FALSE;
+
+	if (ifunc != 0) {
+		lb.cb = &cb;
+	} else {
+		lua_newtable (L);
+	}
+
+	err = cached_list (&args, list_func, &lb, get_client (L), pool);
+	IF_CALLBACK_ERROR_RETURN (cb, err, pool, L);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return ifunc != 0 ? 0 : 1;
+}
+
+
+static int
+l_list (lua_State *L) {
+	return list_path (L, 3, 0);
+}
+
+
+static int
+l_list_each (lua_State *L) {
+	luaL_checktype (L, 3, LUA_TFUNCTION);
+	return list_path (L, 4, 3);
+}
+
+
+/* Sets the revprops field of the table on the top of the stack to the
+   properties of REVPROPS other than the author, date and message, if
+   there are any */
+static void
+push_custom_revprops (lua_State *L, apr_hash_t *revprops, apr_pool_t *pool) {
+	apr_hash_index_t *hi;
+	int n = 0;
+
+	if (revprops == NULL) {
+		return;
+	}
+
+	for (hi = apr_hash_first (pool, revprops); hi; hi = apr_hash_next (hi)) {
+		const void *key;
+		void *val;
+		svn_string_t *value;
+
+		apr_hash_this (hi, &key, NULL, &val);
+		value = val;
+
+		if (strcmp (key, SVN_PROP_REVISION_AUTHOR) == 0
+				|| strcmp (key, SVN_PROP_REVISION_DATE) == 0
+				|| strcmp (key, SVN_PROP_REVISION_LOG) == 0) {
+			continue;
+		}
+
+		if (n++ == 0) {
+			lua_newtable (L);
+		}
+		lua_pushlstring (L, value->data, value->len);
+		lua_setfield (L, -2, key);
+	}
+
+	if (n > 0) {
+		lua_setfield (L, -2, "revprops");
+	}
+}
+
+
+/* How log gives the changed paths of an entry: as a table of records
+   indexed by path, or as an array of tuples sorted by path */
+enum paths_format {
+	paths_table,
+	paths_compact
+};
+
+
+/* Reads the changed_paths option of the table at ITABLE, "table" or
+   "compact". Giving it turns on discover_changed_paths. */
+static void
+getpathsfield (lua_State *L, int itable, enum paths_format *format,
+			   svn_boolean_t *discover) {
+	const char *s;
+
+	lua_getfield (L, itable, "changed_paths");
+	s = lua_tostring (L, -1);
+	if (s != NULL) {
+		if (strcmp (s, "table") == 0) {
+			*format = paths_table;
+		} else if (strcmp (s, "compact") == 0) {
+			*format = paths_compact;
+		} else {
+			luaL_error (L, "unknown changed paths format '%s'", s);
+		}
+		*discover = TRUE;
+	}
+	lua_pop (L, 1);
+}
+
+
+/* Pushes the kind of a changed path, or nil when the server did not
+   tell it */
+static void
+push_node_kind (lua_State *L, svn_node_kind_t kind) {
+	if (kind == svn_node_unknown) {
+		lua_pushnil (L);
+	} else {
+		lua_pushstring (L, svn_node_kind_to_word (kind));
+	}
+}
+
+
+/* Pushes the changed path CP as a record with its action ("A", "D",
+   "M" or "R"), the kind of its node and where it was copied from */
+static void
+push_changed_path (lua_State *L, const svn_log_changed_path2_t *cp) {
+	lua_createtable (L, 0, 4);
+
+	lua_pushlstring (L, &cp->action, 1);
+	lua_setfield (L, -2, "action");
+
+	push_node_kind (L, cp->node_kind);
+	lua_setfield (L, -2, "node_kind");
+
+	if (cp->copyfrom_path != NULL) {
+		lua_pushstring (L, cp->copyfrom_path);
+		lua_setfield (L, -2, "copyfrom_path");
+
+		lua_pushinteger (L, cp->copyfrom_rev);
+		lua_setfield (L, -2, "copyfrom_rev");
+	}
+}
+
+
+/* Pushes the changed path PATH as the tuple {action, directory, name,
+   node_kind, copyfrom_path, copyfrom_rev}. The directory is split off
+   so that the strings Lua interns are shared by all the paths under
+   it, which keeps long histories small. */
+static void
+push_changed_path_tuple (lua_State *L, const char *path,
+						 const svn_log_changed_path2_t *cp, apr_pool_t *pool) {
+	const char *dir, *name;
+
+	svn_path_split (path, &dir, &name, pool);
+
+	lua_createtable (L, 6, 0);
+
+	lua_pushlstring (L, &cp->action, 1);
+	lua_rawseti (L, -2, 1);
+
+	lua_pushstring (L, dir);
+	lua_rawseti (L, -2, 2);
+
+	lua_pushstring (L, name);
+	lua_rawseti (L, -2, 3);
+
+	push_node_kind (L, cp->node_kind);
+	lua_rawseti (L, -2, 4);
+
+	if (cp->copyfrom_path != NULL) {
+		lua_pushstring (L, cp->copyfrom_path);
+		lua_rawseti (L, -2, 5);
+
+		lua_pushinteger (L, cp->copyfrom_rev);
+		lua_rawseti (L, -2, 6);
+	}
+}
+
+
+/* Sets the changed_paths field of the table on the top of the stack to
+   the changed paths of LE in FORMAT, if they were discovered */
+static void
+push_changed_paths (lua_State *L, svn_log_entry_t *le, enum paths_format format,
+					apr_pool_t *pool) {
+	apr_hash_index_t *hi;
+
+	if (le->changed_paths2 == NULL) {
+		return;
+	}
+
+	if (format == paths_compact) {
+		apr_array_header_t *sorted;
+		int i;
+
+		sorted = apr_array_make (pool, apr_hash_count (le->changed_paths2), sizeof (const char *));
+		for (hi = apr_hash_first (pool, le->changed_paths2); hi; hi = apr_hash_next (hi)) {
+			const void *key;
+
+			apr_hash_this (hi, &key, NULL, NULL);
+			APR_ARRAY_PUSH (sorted, const char *) = key;
+		}
+		qsort (sorted->elts, sorted->nelts, sorted->elt_size, svn_sort_compare_paths);
+
+		lua_createtable (L, sorted->nelts, 0);
+		for (i = 0; i < sorted->nelts; i++) {
+			const char *path = APR_ARRAY_IDX (sorted, i, const char *);
+
+			push_changed_path_tuple (L, path,
+									 apr_hash_get (le->changed_paths2, path, APR_HASH_KEY_STRING),
+									 pool);
+			lua_rawseti (L, -2, i + 1);
+		}
+	} else {
+		lua_newtable (L);
+		for (hi = apr_hash_first (pool, le->changed_paths2); hi; hi = apr_hash_next (hi)) {
+			const void *key;
+			void *val;
+
+			apr_hash_this (hi, &key, NULL, &val);
+			push_changed_path (L, val);
+			lua_setfield (L, -2, key);
+		}
+	}
+	lua_setfield (L, -2, "changed_paths");
+}
+
+
+/* Pushes the table describing the log entry LE, with its date in
+   TIME and its changed paths in PATHS */
+static void
+push_log_entry (lua_State *L, svn_log_entry_t *le, enum time_format time,
+				enum paths_format paths, apr_pool_t *pool) {
+	const char *author, *date, *message;
+	apr_time_t when;
+
+	svn_compat_log_revprops_out(&author, &date, &message, le->revprops);
+
+	lua_newtable (L);
+
+	if (time == time_string || date == NULL) {
+		lua_pushstring (L, date);
+	} else {
+		svn_error_t *err = svn_time_from_cstring (&when, date, pool);
+
+		if (err) {
+			svn_error_clear (err);
+			lua_pushnil (L);
+		} else {
+			push_time (L, when, time);
+		}
+	}
+	lua_setfield (L, -2, "date");
+
+	lua_pushstring (L, message);
+	lua_setfield (L, -2, "message");
+
+	lua_pushstring (L, author);
+	lua_setfield (L, -2, "author");
+
+	push_custom_revprops (L, le->revprops, pool);
+
+	push_changed_paths (L, le, paths, pool);
+}
+
+
+typedef struct log_bt {
+	lua_State *L;
+	enum time_format time;
+	enum paths_format paths;
+} log_bt;
+
+
+static svn_error_t *
+log_receiver (void *baton, svn_log_entry_t *le, apr_pool_t *pool)
+{
+	log_bt *lb = baton;
+
+	lua_pushinteger (lb->L, le->revision);
+
+	push_log_entry (lb->L, le, lb->time, lb->paths, pool);
+
+	lua_settable (lb->L, -3);
+
+	return SVN_NO_ERROR;
+}
+
+
+/* Arguments of a log request */
+typedef struct log_args {
+	const char *path;
+	svn_opt_revision_t start;
+	svn_opt_revision_t end;
+	int limit;
+	svn_boolean_t discover_changed_paths;
+	svn_boolean_t strict_node_history;
+	svn_boolean_t include_merged_revisions;
+	enum time_format time;
+	enum paths_format paths;
+	apr_array_header_t *revprops;   /* names to fetch, or NULL for all */
+} log_args;
+
+
+/* Reads the path and the revisions of a log request, its limit at
+   ILIMIT and its options from the table at ITABLE. When ILIMIT is 0,
+   the limit is an option. */
+static void
+get_log_args (lua_State *L, int ilimit, int itable, log_args *args) {
+	args->path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
+	args->limit = 0;
+	args->discover_changed_paths = FALSE;
+	args->strict_node_history = FALSE;
+	args->include_merged_revisions = FALSE;
+	args->time = time_string;
+	args->paths = paths_table;
+	args->revprops = NULL;
+	args->start.kind = svn_opt_revision_number;
+	
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		args->start.value.number = 0;
+	} else {
+		args->start.value.number = lua_tointeger (L, 2);
+	}
+
+	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
+		args->end.kind = get_revision_kind (args->path);
+	} else {
+		args->end.kind = svn_opt_revision_number;
+		args->end.value.number = lua_tointeger (L, 3);
+	}
+
+	if (ilimit != 0 && lua_gettop (L) >= ilimit) {
+		args->limit = lua_tointeger (L, ilimit);
+	}
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		if (ilimit == 0) {
+			getintfield(L, itable, "limit", -1, &args->limit);
+		}
+		getboolfield(L, itable, "discover_changed_paths", -1, &args->discover_changed_paths);
+		getboolfield(L, itable, "strict_node_history", -1, &args->strict_node_history);
+		getboolfield(L, itable, "include_merged_revisions", -1, &args->include_merged_revisions);
+		gettimefield (L, itable, &args->time);
+		getpathsfield (L, itable, &args->paths, &args->discover_changed_paths);
+
+		/* Only checked here, see getrevpropsfield */
+		lua_getfield (L, itable, "revprops");
+		if (!lua_isnil (L, -1)) {
+			int i, n;
+
+			if (!lua_istable (L, -1)) {
+				luaL_error (L, "revprops must be an array of names");
+			}
+			n = lua_objlen (L, -1);
+			for (i = 1; i <= n; i++) {
+				lua_rawgeti (L, -1, i);
+				if (!lua_isstring (L, -1)) {
+					luaL_error (L, "revprops must be an array of names");
+				}
+				lua_pop (L, 1);
+			}
+		}
+		lua_pop (L, 1);
+	} 
+}
+
+
+/* Reads the revprops option of the table at ITABLE, checked by
+   get_log_args, into ARGS */
+static void
+getrevpropsfield (lua_State *L, int itable, log_args *args, apr_pool_t *pool) {
+	int i, n;
+
+	if (lua_gettop (L) < itable || !lua_istable (L, itable)) {
+		return;
+	}
+
+	lua_getfield (L, itable, "revprops");
+	if (lua_istable (L, -1)) {
+		n = lua_objlen (L, -1);
+		args->revprops = apr_array_make (pool, n, sizeof (const char *));
+		for (i = 1; i <= n; i++) {
+			lua_rawgeti (L, -1, i);
+			APR_ARRAY_PUSH (args->revprops, const char *) = apr_pstrdup (pool, lua_tostring (L, -1));
+			lua_pop (L, 1);
+		}
+	}
+	lua_pop (L, 1);
+}
+
+
+/* Runs the log request of ARGS, whose path is canonical, handing the
+   entries to RECEIVER */
+static svn_error_t *
+run_log (const log_args *args, svn_log_entry_receiver_t receiver, void *baton,
+		 svn_client_ctx_t *ctx, apr_pool_t *pool) {
+	apr_array_header_t *array;
+	apr_array_header_t *revision_ranges;
+	svn_opt_revision_range_t *range;
+	svn_opt_revision_t peg_revision;
+
+	peg_revision.kind = svn_opt_revision_unspecified;
+
+	array = apr_array_make (pool, 1, sizeof (const char *));
+	APR_ARRAY_PUSH(array, const char *) = args->path;
+
+	range = apr_palloc(pool, sizeof(svn_opt_revision_range_t));
+	range->start = args->start;
+	range->end = args->end;
+
+	revision_ranges = apr_array_make(pool, 1, sizeof(svn_opt_revision_range_t *));
+	APR_ARRAY_PUSH(revision_ranges, svn_opt_revision_range_t *) = range;
+
+	return svn_client_log5 (array, &peg_revision, revision_ranges, args->limit,
+					args->discover_changed_paths, args->strict_node_history,
+					args->include_merged_revisions, args->revprops, receiver, baton, ctx, pool);
+}
+
+
+/* The log cache of a URL, in four files that only grow. The records
+   file starts with a header and holds the fixed size records of the
+   entries, oldest first; the paths file holds the records of their
+   changed paths and the strings file the strings they point to. Authors
+   and paths are stored once: the intern file is a hash table of their
+   offsets, so that a sync finds them without reading the strings. A
+   sync appends to the files and then writes the header, which alone
+   tells how much of them is valid. The intern table is changed in
+   place, so the header also tells when a sync is changing it: a table
+   left so by a crash is rebuilt by the next sync. The files are in the
+   byte order of the host and are mapped in memory, so that looking up a
+   revision reads nothing but the records it visits. Counts and offsets
+   are 32 bits wide, and a cache stops growing at LOG_INDEX_LIMIT.
+
+   The revision properties other than the author, the date and the
+   message are kept together in one string of the strings file, see
+   log_index_encode_revprops. */
+typedef struct log_index_header {
+	char magic[8];              /* LOG_INDEX_MAGIC */
+	apr_uint32_t nrecords;
+	apr_uint32_t npaths;
+	apr_uint32_t strings_size;
+	apr_int32_t synced;         /* the log is complete up to it */
+	apr_uint32_t interned;      /* strings in the intern table */
+	apr_uint32_t changing;      /* the intern table is being changed */
+} log_index_header;
+
+typedef struct log_index_record {
+	apr_int32_t revision;
+	apr_uint32_t author;        /* offsets in the strings, or LOG_INDEX_NONE */
+	apr_uint32_t date;
+	apr_uint32_t message;
+	apr_uint32_t paths;         /* index of its first changed path */
+	apr_uint32_t npaths;
+	apr_uint32_t revprops;      /* the other revision properties */
+} log_index_record;
+
+typedef struct log_index_path {
+	apr_uint32_t path;
+	apr_uint32_t copyfrom_path;
+	apr_int32_t copyfrom_rev;
+	char action;
+	char node_kind;
+	char padding[2];
+} log_index_path;
+
+#define LOG_INDEX_MAGIC "luasvnL3"
+#define LOG_INDEX_NONE 0xffffffff
+
+/* Most records, changed paths and bytes of strings in a log cache, and
+   most slots of its intern table */
+#define LOG_INDEX_LIMIT 0x7fffffff
+#define LOG_INTERN_MAX_SIZE 0x40000000
+
+/* Smallest intern table, in slots. A slot holds the offset of its string
+   plus one, or 0 when it is free. */
+#define LOG_INTERN_MIN_SIZE 1024
+
+
+/* The log of a URL kept in the disk cache of a client: the mapped files
+   and the entries added to them by the last sync, which are all younger.
+   The entries have all their changed paths. */
+typedef struct log_cache_t {
+	const char *path;               /* of the files, without suffix */
+	svn_revnum_t synced;            /* or SVN_INVALID_REVNUM when empty */
+
+	const log_index_record *records;
+	apr_uint32_t nrecords;
+	const log_index_path *paths;
+	apr_uint32_t npaths;
+	const char *strings;
+	apr_uint32_t strings_size;
+	apr_uint32_t interned;
+
+	apr_array_header_t *entries;    /* of svn_log_entry_t *, oldest first */
+} log_cache_t;
+
+
+static const char *
+log_cache_file (const log_cache_t *cache, const char *suffix, apr_pool_t *pool) {
+	return apr_pstrcat (pool, cache->path, suffix, NULL);
+}
+
+
+/* Maps the first SIZE bytes of the file of CACHE with SUFFIX. Fails
+   when the file is shorter. */
+static svn_boolean_t
+log_cache_map (const void **data, const log_cache_t *cache, const char *suffix,
+			   apr_uint64_t size, apr_pool_t *pool) {
+	apr_file_t *file;
+	apr_finfo_t finfo;
+	apr_mmap_t *mmap;
+
+	*data = NULL;
+	if (size == 0) {
+		return TRUE;
+	}
+
+	if (apr_file_open (&file, log_cache_file (cache, suffix, pool), APR_READ | APR_BINARY,
+					   APR_OS_DEFAULT, pool)
+			|| apr_file_info_get (&finfo, APR_FINFO_SIZE, file)
+			|| (apr_uint64_t) finfo.size < size
+			|| apr_mmap_create (&mmap, file, 0, (apr_size_t) size, APR_MMAP_READ, pool)) {
+		return FALSE;
+	}
+
+	*data = mmap->mm;
+	return TRUE;
+}
+
+
+/* Maps the files of CACHE. The cache is left empty when they are
+   missing or broken, and is then rebuilt. */
+static void
+log_cache_load (log_cache_t *cache, apr_pool_t *pool) {
+	log_index_header header;
+	const void *records, *paths, *strings;
+	apr_file_t *file;
+	apr_size_t len = sizeof (log_index_header);
+
+	cache->synced = SVN_INVALID_REVNUM;
+	cache->records = NULL;
+	cache->nrecords = 0;
+	cache->paths = NULL;
+	cache->npaths = 0;
+	cache->strings = NULL;
+	cache->strings_size = 0;
+	cache->interned = 0;
+	cache->entries = apr_array_make (pool, 0, sizeof (svn_log_entry_t *));
+
+	/* The header is read rather than mapped, as a sync rewrites it */
+	if (apr_file_open (&file, log_cache_file (cache, ".rec", pool), APR_READ | APR_BINARY,
+					   APR_OS_DEFAULT, pool)
+			|| apr_file_read_full (file, &header, len, &len)
+			|| memcmp (header.magic, LOG_INDEX_MAGIC, sizeof (header.magic)) != 0) {
+		return;
+	}
+
+	if (!log_cache_map (&records, cache, ".rec", sizeof (log_index_header)
+						+ (apr_uint64_t) header.nrecords * sizeof (log_index_record), pool)
+			|| !log_cache_map (&paths, cache, ".paths",
+							   (apr_uint64_t) header.npaths * sizeof (log_index_path), pool)
+			|| !log_cache_map (&strings, cache, ".str", header.strings_size, pool)) {
+		return;
+	}
+
+	/* Every string in range is then terminated */
+	if (header.strings_size > 0 && ((const char *) strings)[header.strings_size - 1] != '\0') {
+		return;
+	}
+
+	cache->records = (const log_index_record *) ((const log_index_header *) records + 1);
+	cache->nrecords = header.nrecords;
+	cache->paths = paths;
+	cache->npaths = header.npaths;
+	cache->strings = strings;
+	cache->strings_size = header.strings_size;
+	cache->interned = header.interned;
+	cache->synced = header.synced;
+}
+
+
+static const char *
+log_cache_string (const log_cache_t *cache, apr_uint32_t offset) {
+	return offset < cache->strings_size ? cache->strings + offset : NULL;
+}
+
+
+static int
+log_cache_count (const log_cache_t *cache) {
+	return (int) cache->nrecords + cache->entries->nelts;
+}
+
+
+static svn_revnum_t
+log_cache_revision (const log_cache_t *cache, int i) {
+	if (i < (int) cache->nrecords) {
+		return cache->records[i].revision;
+	}
+	return APR_ARRAY_IDX (cache->entries, i - cache->nrecords, svn_log_entry_t *)->revision;
+}
+
+
+/* Gets the index of the first entry of CACHE at or after REV */
+static int
+log_cache_find (const log_cache_t *cache, svn_revnum_t rev) {
+	int lo = 0;
+	int hi = log_cache_count (cache);
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (log_cache_revision (cache, mid) < rev) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+
+/* Adds VALUE, which is not copied, to REVPROPS */
+static void
+set_revprop (apr_hash_t *revprops, const char *name, const char *value, apr_pool_t *pool) {
+	svn_string_t *s;
+
+	if (value != NULL) {
+		s = apr_palloc (pool, sizeof (svn_string_t));
+		s->data = value;
+		s->len = strlen (value);
+		apr_hash_set (revprops, name, APR_HASH_KEY_STRING, s);
+	}
+}
+
+
+/* Adds to REVPROPS the revision properties encoded at OFFSET in the
+   strings of CACHE by log_index_encode_revprops. The values are not
+   copied. */
+static void
+log_cache_revprops (const log_cache_t *cache, apr_uint32_t offset, apr_hash_t *revprops,
+					apr_pool_t *pool) {
+	const char *p = log_cache_string (cache, offset);
+	const char *end = cache->strings + cache->strings_size;
+
+	/* Every string ends before END, see log_cache_load */
+	while (p != NULL && p < end && *p != '\0') {
+		const char *name = p;
+		const char *len = name + strlen (name) + 1;
+		unsigned long n;
+		svn_string_t *s;
+
+		if (len >= end) {
+			return;
+		}
+		n = strtoul (len, NULL, 10);
+		p = len + strlen (len) + 1;
+		if (n >= (unsigned long) (end - p)) {
+			return;
+		}
+
+		s = apr_palloc (pool, sizeof (svn_string_t));
+		s->data = p;
+		s->len = n;
+		apr_hash_set (revprops, name, APR_HASH_KEY_STRING, s);
+		p += n + 1;
+	}
+}
+
+
+/* Gets the entry at index I of CACHE, with its changed paths when
+   CHANGED_PATHS is set. The strings of the file are not copied. */
+static svn_log_entry_t *
+log_cache_entry (const log_cache_t *cache, int i, svn_boolean_t changed_paths,
+				 apr_pool_t *pool) {
+	const log_index_record *rec;
+	svn_log_entry_t *le;
+	apr_uint32_t j;
+
+	if (i >= (int) cache->nrecords) {
+		le = apr_palloc (pool, sizeof (svn_log_entry_t));
+		*le = *APR_ARRAY_IDX (cache->entries, i - cache->nrecords, svn_log_entry_t *);
+		if (!changed_paths) {
+			le->changed_paths = NULL;
+			le->changed_paths2 = NULL;
+		}
+		return le;
+	}
+
+	rec = cache->records + i;
+	le = svn_log_entry_create (pool);
+	le->revision = rec->revision;
+
+	le->revprops = apr_hash_make (pool);
+	set_revprop (le->revprops, SVN_PROP_REVISION_AUTHOR, log_cache_string (cache, rec->author), pool);
+	set_revprop (le->revprops, SVN_PROP_REVISION_DATE, log_cache_string (cache, rec->date), pool);
+	set_revprop (le->revprops, SVN_PROP_REVISION_LOG, log_cache_string (cache, rec->message), pool);
+	log_cache_revprops (cache, rec->revprops, le->revprops, pool);
+
+	if (!changed_paths || rec->paths > cache->npaths || rec->npaths > cache->npaths - rec->paths) {
+		return le;
+	}
+
+	le->changed_paths2 = apr_hash_make (pool);
+	for (j = 0; j < rec->npaths; j++) {
+		const log_index_path *p = cache->paths + rec->paths + j;
+		const char *path = log_cache_string (cache, p->path);
+		svn_log_changed_path2_t *cp;
+
+		if (path == NULL) {
+			continue;
+		}
+
+		cp = svn_log_changed_path2_create (pool);
+		cp->action = p->action;
+		cp->copyfrom_path = log_cache_string (cache, p->copyfrom_path);
+		cp->copyfrom_rev = p->copyfrom_rev;
+		cp->node_kind = p->node_kind;
+		apr_hash_set (le->changed_paths2, path, APR_HASH_KEY_STRING, cp);
+	}
+	/* The old structure is a prefix of the new one */
+	le->changed_paths = le->changed_paths2;
+	return le;
+}
+
+
+/* The strings a sync appends to a log cache, and its intern table */
+typedef struct log_index_writer {
+	const log_cache_t *cache;
+	svn_stringbuf_t *strings;   /* the ones past those of the cache */
+	apr_uint32_t *intern;
+	apr_uint32_t intern_size;   /* a power of two */
+	apr_uint32_t interned;
+} log_index_writer;
+
+
+/* Gets the string at OFFSET, in the file or among the appended ones */
+static const char *
+log_index_string (const log_index_writer *w, apr_uint32_t offset) {
+	if (offset < w->cache->strings_size) {
+		return w->cache->strings + offset;
+	}
+	offset -= w->cache->strings_size;
+	return offset < w->strings->len ? w->strings->data + offset : NULL;
+}
+
+
+/* Finds the slot of S in the intern table or, when it is not there,
+   the free slot where it goes. Slots left past the strings by a sync
+   that did not finish are free. */
+static svn_boolean_t
+log_index_lookup (const log_index_writer *w, const char *s, apr_uint32_t **slot) {
+	apr_ssize_t len = APR_HASH_KEY_STRING;
+	apr_uint32_t mask = w->intern_size - 1;
+	apr_uint32_t i = apr_hashfunc_default (s, &len) & mask;
+	const char *t;
+
+	for (;; i = (i + 1) & mask) {
+		*slot = w->intern + i;
+		if (**slot == 0 || (t = log_index_string (w, **slot - 1)) == NULL) {
+			return FALSE;
+		}
+		if (strcmp (s, t) == 0) {
+			return TRUE;
+		}
+	}
+}
+
+
+/* Adds the LEN bytes of DATA to the strings and gets their offset */
+static apr_uint32_t
+log_index_add_bytes (log_index_writer *w, const char *data, apr_size_t len) {
+	apr_uint32_t offset = w->cache->strings_size + (apr_uint32_t) w->strings->len;
+
+	svn_stringbuf_appendbytes (w->strings, data, len);
+	return offset;
+}
+
+
+/* Adds S to the strings, or finds it there when INTERN is set, and gets
+   its offset */
+static apr_uint32_t
+log_index_add_string (log_index_writer *w, const char *s, svn_boolean_t intern) {
+	apr_uint32_t *slot = NULL;
+	apr_uint32_t offset;
+
+	if (s == NULL) {
+		return LOG_INDEX_NONE;
+	}
+
+	if (intern && log_index_lookup (w, s, &slot)) {
+		return *slot - 1;
+	}
+
+	offset = log_index_add_bytes (w, s, strlen (s) + 1);
+
+	if (slot != NULL) {
+		if (*slot == 0) {
+			w->interned++;
+		}
+		*slot = offset + 1;
+	}
+	return offset;
+}
+
+
+/* Encodes into BLOB the revision properties of REVPROPS other than the
+   author, the date and the message: for each one its name and the
+   decimal length of its value, both terminated, then the value and a
+   terminator. An empty name ends them. Gives FALSE when there are
+   none. */
+static svn_boolean_t
+log_index_encode_revprops (svn_stringbuf_t *blob, apr_hash_t *revprops, apr_pool_t *pool) {
+	apr_hash_index_t *hi;
+
+	svn_stringbuf_setempty (blob);
+	if (revprops == NULL) {
+		return FALSE;
+	}
+
+	for (hi = apr_hash_first (pool, revprops); hi; hi = apr_hash_next (hi)) {
+		const void *key;
+		void *val;
+		const svn_string_t *value;
+		const char *len;
+
+		apr_hash_this (hi, &key, NULL, &val);
+		value = val;
+		if (strcmp (key, SVN_PROP_REVISION_AUTHOR) == 0
+				|| strcmp (key, SVN_PROP_REVISION_DATE) == 0
+				|| strcmp (key, SVN_PROP_REVISION_LOG) == 0) {
+			continue;
+		}
+
+		len = apr_psprintf (pool, "%lu", (unsigned long) value->len);
+		svn_stringbuf_appendbytes (blob, key, strlen (key) + 1);
+		svn_stringbuf_appendbytes (blob, len, strlen (len) + 1);
+		svn_stringbuf_appendbytes (blob, value->data, value->len);
+		svn_stringbuf_appendbytes (blob, "", 1);
+	}
+
+	if (blob->len == 0) {
+		return FALSE;
+	}
+	svn_stringbuf_appendbytes (blob, "", 1);
+	return TRUE;
+}
+
+
+/* Opens the intern table of the cache of W for a sync that interns at
+   most MORE strings. The table is mapped and changed in place. When it
+   would get over half full, or it is missing, it is rebuilt twice as
+   large in memory and REBUILT is set: rehashing then costs a constant
+   time per string on the whole. A table that a sync left CHANGING is
+   rebuilt too, without its slots past the strings of the cache. */
+static void
+log_index_open_intern (log_index_writer *w, apr_uint32_t more, svn_boolean_t changing,
+					   svn_boolean_t *rebuilt, apr_pool_t *pool) {
+	apr_uint32_t *old = NULL;
+	apr_uint32_t old_size = 0;
+	apr_uint64_t needed;
+	apr_uint32_t i;
+	apr_file_t *file;
+	apr_finfo_t finfo;
+	apr_mmap_t *mmap;
+
+	if (w->cache->strings_size > 0
+			&& !apr_file_open (&file, log_cache_file (w->cache, ".intern", pool),
+							   APR_READ | APR_WRITE | APR_BINARY, APR_OS_DEFAULT, pool)
+			&& !apr_file_info_get (&finfo, APR_FINFO_SIZE, file)
+			&& finfo.size >= (apr_off_t) (LOG_INTERN_MIN_SIZE * sizeof (apr_uint32_t))
+			&& !apr_mmap_create (&mmap, file, 0, (apr_size_t) finfo.size,
+								 APR_MMAP_READ | APR_MMAP_WRITE, pool)) {
+		old = mmap->mm;
+		old_size = (apr_uint32_t) (finfo.size / sizeof (apr_uint32_t));
+	}
+
+	needed = 2 * ((apr_uint64_t) w->interned + more);
+
+	/* A size that is not a power of two is a broken file */
+	if (old != NULL && (old_size & (old_size - 1)) == 0 && needed <= old_size && !changing) {
+		w->intern = old;
+		w->intern_size = old_size;
+		*rebuilt = FALSE;
+		return;
+	}
+
+	w->intern_size = LOG_INTERN_MIN_SIZE;
+	while (w->intern_size < needed) {
+		w->intern_size *= 2;
+	}
+	w->intern = apr_pcalloc (pool, w->intern_size * sizeof (apr_uint32_t));
+	w->interned = 0;
+	*rebuilt = TRUE;
+
+	for (i = 0; i < old_size; i++) {
+		const char *s;
+		apr_uint32_t *slot;
+
+		if (old[i] != 0 && (s = log_index_string (w, old[i] - 1)) != NULL
+				&& !log_index_lookup (w, s, &slot)) {
+			*slot = old[i];
+			w->interned++;
+		}
+	}
+}
+
+
+/* Writes the LEN bytes of DATA at OFFSET in the file of CACHE with
+   SUFFIX or, with REPLACE, replaces the file by them at once */
+static svn_error_t *
+log_cache_write (const log_cache_t *cache, luasvn_client *client, const char *suffix,
+				 apr_off_t offset, const void *data, apr_size_t len,
+				 svn_boolean_t replace, apr_pool_t *pool) {
+	const char *path = log_cache_file (cache, suffix, pool);
+	const char *tmp_dir, *tmp_path;
+	apr_file_t *file;
+
+	if (replace) {
+		tmp_dir = svn_path_join (client->cache_dir, "tmp", pool);
+		SVN_ERR (svn_io_make_dir_recursively (tmp_dir, pool));
+		SVN_ERR (svn_io_write_unique (&tmp_path, tmp_dir, data, len, svn_io_file_del_none, pool));
+		return svn_io_file_rename (tmp_path, path, pool);
+	}
+
+	SVN_ERR (svn_io_file_open (&file, path, APR_WRITE | APR_CREATE | APR_BINARY,
+							   APR_OS_DEFAULT, pool));
+	SVN_ERR (svn_io_file_seek (file, APR_SET, &offset, pool));
+	SVN_ERR (svn_io_file_write_full (file, data, len, NULL, pool));
+	return svn_io_file_close (file, pool);
+}
+
+
+/* Appends the entries added by the sync to the files of CACHE, then
+   writes the header, so that a sync writes nothing but what it adds.
+   The records file is locked meanwhile. Nothing is written when another
+   process synced the files since they were loaded, or when they would
+   grow past LOG_INDEX_LIMIT; files that could not be loaded are written
+   anew. */
+static svn_error_t *
+log_cache_append (log_cache_t *cache, luasvn_client *client, apr_pool_t *pool) {
+	svn_stringbuf_t *records, *paths, *blob;
+	log_index_header header;
+	log_index_writer w;
+	apr_hash_index_t *hi;
+	apr_file_t *file;
+	apr_status_t status;
+	apr_size_t len = sizeof (log_index_header);
+	apr_uint32_t npaths = 0;
+	apr_uint64_t more = 0;
+	apr_uint64_t more_paths = 0;
+	apr_uint64_t more_size = 0;
+	svn_boolean_t fresh, rebuilt;
+	apr_off_t offset;
+	int i;
+
+	SVN_ERR (svn_io_make_dir_recursively (svn_path_dirname (cache->path, pool), pool));
+	SVN_ERR (svn_io_file_open (&file, log_cache_file (cache, ".rec", pool),
+							   APR_READ | APR_WRITE | APR_CREATE | APR_BINARY,
+							   APR_OS_DEFAULT, pool));
+
+	status = apr_file_lock (file, APR_FLOCK_EXCLUSIVE);
+	if (status) {
+		return svn_error_wrap_apr (status, "Can't lock the log cache");
+	}
+
+	status = apr_file_read_full (file, &header, len, &len);
+	if (status && !APR_STATUS_IS_EOF (status)) {
+		return svn_error_wrap_apr (status, "Can't read the log cache");
+	}
+
+	/* A cache loaded empty has the whole log */
+	fresh = cache->nrecords == 0 && cache->npaths == 0 && cache->strings_size == 0;
+
+	if (!fresh && (len < sizeof (log_index_header)
+				   || memcmp (header.magic, LOG_INDEX_MAGIC, sizeof (header.magic)) != 0
+				   || header.nrecords != cache->nrecords || header.npaths != cache->npaths
+				   || header.strings_size != cache->strings_size)) {
+		return svn_io_file_close (file, pool);
+	}
+
+	/* Bounds of what the sync adds, checked before anything is written.
+	   A revision property takes at most its name, its value, the length
+	   of the value and three terminators. */
+	for (i = 0; i < cache->entries->nelts; i++) {
+		svn_log_entry_t *le = APR_ARRAY_IDX (cache->entries, i, svn_log_entry_t *);
+
+		if (le->revprops != NULL) {
+			for (hi = apr_hash_first (pool, le->revprops); hi; hi = apr_hash_next (hi)) {
+				const void *key;
+				void *val;
+
+				apr_hash_this (hi, &key, NULL, &val);
+				more_size += strlen (key) + ((svn_string_t *) val)->len + 24;
+			}
+		}
+		more_size++;
+		more++;
+
+		if (le->changed_paths2 != NULL) {
+			for (hi = apr_hash_first (pool, le->changed_paths2); hi; hi = apr_hash_next (hi)) {
+				const void *key;
+				void *val;
+				svn_log_changed_path2_t *cp;
+
+				apr_hash_this (hi, &key, NULL, &val);
+				cp = val;
+				more_size += strlen (key) + 1
+					+ (cp->copyfrom_path ? strlen (cp->copyfrom_path) + 1 : 0);
+				more += 2;
+				more_paths++;
+			}
+		}
+	}
+
+	if (cache->nrecords + (apr_uint64_t) cache->entries->nelts > LOG_INDEX_LIMIT
+			|| cache->npaths + more_paths > LOG_INDEX_LIMIT
+			|| cache->strings_size + more_size > LOG_INDEX_LIMIT
+			|| 2 * (cache->interned + more) > LOG_INTERN_MAX_SIZE) {
+		SVN_ERR (svn_io_file_close (file, pool));
+		return svn_error_create (APR_ENOSPC, NULL, "The log cache is full");
+	}
+
+	w.cache = cache;
+	w.strings = svn_stringbuf_create ("", pool);
+	w.interned = cache->interned;
+	log_index_open_intern (&w, (apr_uint32_t) more, !fresh && header.changing, &rebuilt, pool);
+
+	/* Marks the table as being changed, in place or by a rebuilt one
+	   renamed over it, until the new header is written. A cache loaded
+	   empty has no table to keep. */
+	if (!fresh) {
+		header.changing = 1;
+		offset = 0;
+		SVN_ERR (svn_io_file_seek (file, APR_SET, &offset, pool));
+		SVN_ERR (svn_io_file_write_full (file, &header, sizeof (log_index_header), NULL, pool));
+	}
+
+	records = svn_stringbuf_create_ensure (cache->entries->nelts * sizeof (log_index_record), pool);
+	paths = svn_stringbuf_create ("", pool);
+	blob = svn_stringbuf_create ("", pool);
+
+	for (i = 0; i < cache->entries->nelts; i++) {
+		svn_log_entry_t *le = APR_ARRAY_IDX (cache->entries, i, svn_log_entry_t *);
+		const char *author, *date, *message;
+		log_index_record rec;
+
+		svn_compat_log_revprops_out (&author, &date, &message, le->revprops);
+
+		rec.revision = (apr_int32_t) le->revision;
+		rec.author = log_index_add_string (&w, author, TRUE);
+		rec.date = log_index_add_string (&w, date, FALSE);
+		rec.message = log_index_add_string (&w, message, FALSE);
+		rec.paths = cache->npaths + npaths;
+		rec.npaths = 0;
+		rec.revprops = LOG_INDEX_NONE;
+		if (log_index_encode_revprops (blob, le->revprops, pool)) {
+			rec.revprops = log_index_add_bytes (&w, blob->data, blob->len);
+		}
+
+		if (le->changed_paths2 != NULL) {
+			for (hi = apr_hash_first (pool, le->changed_paths2); hi; hi = apr_hash_next (hi)) {
+				const void *key;
+				void *val;
+				svn_log_changed_path2_t *cp;
+				log_index_path p;
+
+				apr_hash_this (hi, &key, NULL, &val);
+				cp = val;
+
+				memset (&p, 0, sizeof (log_index_path));
+				p.path = log_index_add_string (&w, key, TRUE);
+				p.copyfrom_path = log_index_add_string (&w, cp->copyfrom_path, TRUE);
+				p.copyfrom_rev = (apr_int32_t) cp->copyfrom_rev;
+				p.action = cp->action;
+				p.node_kind = (char) cp->node_kind;
+
+				svn_stringbuf_appendbytes (paths, (const char *) &p, sizeof (log_index_path));
+				rec.npaths++;
+			}
+		}
+		npaths += rec.npaths;
+
+		svn_stringbuf_appendbytes (records, (const char *) &rec, sizeof (log_index_record));
+	}
+
+	memset (&header, 0, sizeof (log_index_header));
+	memcpy (header.magic, LOG_INDEX_MAGIC, sizeof (header.magic));
+	header.nrecords = cache->nrecords + (apr_uint32_t) cache->entries->nelts;
+	header.npaths = cache->npaths + npaths;
+	header.strings_size = cache->strings_size + (apr_uint32_t) w.strings->len;
+	header.synced = (apr_int32_t) cache->synced;
+	header.interned = w.interned;
+
+	SVN_ERR (log_cache_write (cache, client, ".str", cache->strings_size,
+							  w.strings->data, w.strings->len, fresh, pool));
+	SVN_ERR (log_cache_write (cache, client, ".paths",
+							  (apr_off_t) cache->npaths * sizeof (log_index_path),
+							  paths->data, paths->len, fresh, pool));
+	if (rebuilt) {
+		SVN_ERR (log_cache_write (cache, client, ".intern", 0, w.intern,
+								  w.intern_size * sizeof (apr_uint32_t), TRUE, pool));
+	}
+
+	/* The records file is never replaced, so that the writers waiting
+	   for its lock see the new header. The header goes last, as it makes
+	   the rest valid. */
+	offset = sizeof (log_index_header) + (apr_off_t) cache->nrecords * sizeof (log_index_record);
+	SVN_ERR (svn_io_file_seek (file, APR_SET, &offset, pool));
+	SVN_ERR (svn_io_file_write_full (file, records->data, records->len, NULL, pool));
+
+	offset = 0;
+	SVN_ERR (svn_io_file_seek (file, APR_SET, &offset, pool));
+	SVN_ERR (svn_io_file_write_full (file, &header, sizeof (log_index_header), NULL, pool));
+	return svn_io_file_close (file, pool);
+}
+
+
+/* Saves the entries added to CACHE by the sync, one thread of the
+   process at a time */
+static svn_error_t *
+log_cache_save (log_cache_t *cache, luasvn_client *client, apr_pool_t *pool) {
+	svn_error_t *err;
+
+	apr_thread_mutex_lock (log_cache_mutex);
+	err = log_cache_append (cache, client, pool);
+	apr_thread_mutex_unlock (log_cache_mutex);
+	return err;
+}
+
+
+static svn_error_t *
+log_cache_receiver (void *baton, svn_log_entry_t *le, apr_pool_t *pool) {
+	log_cache_t *cache = baton;
+
+	APR_ARRAY_PUSH (cache->entries, svn_log_entry_t *) =
+		svn_log_entry_dup (le, cache->entries->pool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Adds to CACHE the log of the URL of ARGS from the revision after the
+   synced one up to HEAD, and saves it. A cache that cannot be saved is
+   still used for this call. */
+static svn_error_t *
+log_cache_sync (log_cache_t *cache, luasvn_client *client, const log_args *args,
+				apr_pool_t *pool) {
+	ra_session_entry *entry;
+	apr_array_header_t *paths;
+	svn_revnum_t head;
+	svn_error_t *err;
+
+	SVN_ERR (session_acquire (&entry, client, args->path, pool));
+
+	err = svn_ra_get_latest_revnum (entry->session, &head, pool);
+	if (!err && head > cache->synced) {
+		paths = apr_array_make (pool, 1, sizeof (const char *));
+		APR_ARRAY_PUSH (paths, const char *) = "";
+
+		err = svn_ra_get_log2 (entry->session, paths,
+							   SVN_IS_VALID_REVNUM (cache->synced) ? cache->synced + 1 : 0,
+							   head, 0, TRUE, args->strict_node_history, FALSE, NULL,
+							   log_cache_receiver, cache, pool);
+	}
+	session_release (client, entry, err);
+	SVN_ERR (err);
+
+	if (head > cache->synced) {
+		cache->synced = head;
+		client->log_cache.syncs++;
+		svn_error_clear (log_cache_save (cache, client, pool));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Runs the log request of ARGS like run_log, answering it from the log
+   cache of CLIENT when it is enabled. The log of a URL is only fetched
+   from the server for the revisions past the ones it already has, and
+   a request within them needs no server at all. Requests for merged
+   revisions and for working copies go to the server. */
+static svn_error_t *
+cached_log (const log_args *args, svn_log_entry_receiver_t receiver, void *baton,
+			luasvn_client *client, apr_pool_t *pool) {
+	log_cache_t cache;
+	svn_checksum_t *checksum;
+	svn_revnum_t start, end;
+	apr_pool_t *iterpool;
+	const char *key;
+	int i, first, last;
+
+	if (!client->log_cache.enabled || client->cache_dir == NULL
+			|| !svn_path_is_url (args->path) || args->include_merged_revisions
+			|| args->start.kind != svn_opt_revision_number) {
+		return run_log (args, receiver, baton, client->ctx, pool);
+	}
+
+	key = apr_psprintf (pool, "%s:%d", args->path, args->strict_node_history);
+	SVN_ERR (svn_checksum (&checksum, svn_checksum_md5, key, strlen (key), pool));
+	cache.path = disk_cache_path (client, "log",
+								  svn_checksum_to_cstring_display (checksum, pool), pool);
+	log_cache_load (&cache, pool);
+
+	start = args->start.value.number;
+	end = args->end.kind == svn_opt_revision_number ?
+		args->end.value.number : SVN_INVALID_REVNUM;
+
+	if (!SVN_IS_VALID_REVNUM (end) || !SVN_IS_VALID_REVNUM (cache.synced)
+			|| start > cache.synced || end > cache.synced) {
+		SVN_ERR (log_cache_sync (&cache, client, args, pool));
+	} else {
+		client->log_cache.hits++;
+	}
+
+	if (!SVN_IS_VALID_REVNUM (end)) {
+		end = cache.synced;
+	}
+
+	/* Revisions past HEAD: the server gives the error */
+	if (start > cache.synced || end > cache.synced) {
+		return run_log (args, receiver, baton, client->ctx, pool);
+	}
+
+	first = log_cache_find (&cache, start < end ? start : end);
+	last = log_cache_find (&cache, (start < end ? end : start) + 1);
+	iterpool = svn_pool_create (pool);
+
+	for (i = 0; i < last - first && (args->limit <= 0 || i < args->limit); i++) {
+		svn_log_entry_t *le;
+
+		svn_pool_clear (iterpool);
+		le = log_cache_entry (&cache, start <= end ? first + i : last - 1 - i,
+							  args->discover_changed_paths, iterpool);
+
+		if (args->revprops != NULL) {
+			apr_hash_t *revprops = apr_hash_make (iterpool);
+			int j;
+
+			for (j = 0; j < args->revprops->nelts; j++) {
+				const char *name = APR_ARRAY_IDX (args->revprops, j, const char *);
+				svn_string_t *value = apr_hash_get (le->revprops, name, APR_HASH_KEY_STRING);
+
+				if (value != NULL) {
+					apr_hash_set (revprops, name, APR_HASH_KEY_STRING, value);
+				}
+			}
+			le->revprops = revprops;
+		}
+
+		SVN_ERR (receiver (baton, le, iterpool));
+	}
+
+	svn_pool_destroy (iterpool);
+	return SVN_NO_ERROR;
+}
+
+
+static int
+l_log (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+	
+	log_args args;
+	log_bt lb;
+
+	get_log_args (L, 4, 5, &args);
+
+	init_function (&ctx, &pool, L, 5);
+
+	args.path = svn_path_canonicalize (args.path, pool);
+	getrevpropsfield (L, 5, &args, pool);
+
+	lua_newtable (L);
+
+	lb.L = L;
+	lb.time = args.time;
+	lb.paths = args.paths;
+
+	err = cached_log (&args, log_receiver, &lb, get_client (L), pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+/* Log entries read ahead by the worker of log_iter */
+#define LOG_ITER_MAX_ITEMS 64
+
+
+static svn_error_t *
+log_producer_receiver (void *baton, svn_log_entry_t *le, apr_pool_t *pool) {
+	queue_item *item = malloc (sizeof (queue_item));
+
+	if (item == NULL) {
+		return svn_error_create (APR_ENOMEM, NULL, NULL);
+	}
+
+	item->pool = svn_pool_create (NULL);
+	item->data = svn_log_entry_dup (le, item->pool);
+	item->len = 0;
+
+	return producer_put (baton, item);
+}
+
+
+static svn_error_t *
+log_producer_run (producer_t *p, svn_client_ctx_t *ctx, apr_pool_t *pool) {
+	return run_log (p->baton, log_producer_receiver, p, ctx, pool);
+}
+
+
+static int
+log_producer_push (lua_State *L, producer_t *p, queue_item *item) {
+	svn_log_entry_t *le = item->data;
+	log_args *args = p->baton;
+
+	lua_pushinteger (L, le->revision);
+	push_log_entry (L, le, args->time, args->paths, item->pool);
+	return 2;
+}
+
+
+static int
+l_log_iter (lua_State *L) {
+	producer_t *p;
+	log_args *args;
+	log_args a;
+	cancel_token_t *token;
+	apr_time_t deadline;
+	luasvn_client *client = get_client (L);
+
+	get_log_args (L, 0, 4, &a);
+	getcancelfields (L, 4, client, &deadline, &token);
+
+	p = new_producer (L, client, log_producer_run, log_producer_push);
+	p->max_items = LOG_ITER_MAX_ITEMS;
+	p->deadline = deadline;
+	producer_set_token (L, p, 4, token);
+
+	args = apr_palloc (p->pool, sizeof (log_args));
+	*args = a;
+	args->path = svn_path_canonicalize (a.path, p->pool);
+	getrevpropsfield (L, 4, args, p->pool);
+	p->baton = args;
+
+	return start_producer (L, p);
+}
+
+
+static int
+l_merge (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	svn_opt_revision_t rev1;
+	svn_opt_revision_t rev2;
+
+	const char *source1 = NULL;
+	const char *source2 = NULL;
+	const char *wcpath = NULL;
+	int itable = 6;
+	svn_depth_t depth = svn_depth_infinity;
+	svn_boolean_t ignore_ancestry = FALSE;
+	svn_boolean_t force = FALSE;
+	svn_boolean_t record_only = FALSE;
+	svn_boolean_t dry_run = FALSE;
+
+	source1 = luaL_checkstring (L, 1);
+		
+	if (lua_isnil (L, 2)) {
+		rev1.kind = svn_opt_revision_head;
+	} else {
+		rev1.kind = svn_opt_revision_number;
+		rev1.value.number = lua_tointeger (L, 2);
+	}
+
+	source2 = luaL_checkstring (L, 3);
+
+	if (lua_isnil (L, 4)) {
+		rev2.kind = svn_opt_revision_head;
+	} else {
+		rev2.kind = svn_opt_revision_number;
+		rev2.value.number = lua_tointeger (L, 4);
+	}
+
+	if (lua_gettop (L) < 5 || lua_isnil (L, 5)) {
+		wcpath = "";
+	} else {
+		wcpath = luaL_checkstring (L, 5);
+	}
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "ignore_ancestry", -1, &ignore_ancestry);
+		getboolfield(L, itable, "force", -1, &force);
+		getboolfield(L, itable, "record_only", -1, &record_only);
+		getboolfield(L, itable, "dry_run", -1, &dry_run);
+	}
+
+	init_function (&ctx, &pool, L, itable);
+
+	source1 = svn_path_canonicalize (source1, pool);
+	source2 = svn_path_canonicalize (source2, pool);
+	wcpath = svn_path_canonicalize (wcpath, pool);
+
+	err = svn_client_merge3 (source1, &rev1, source2, &rev2, wcpath, depth,
+					ignore_ancestry, force, record_only, dry_run, NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);	
+
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+static int
+l_mkdir (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+	
+	apr_array_header_t *array;
+	
+	const char *message = (lua_gettop (L) < 2 || lua_isnil (L, 2)) ? "" : luaL_checkstring (L, 2);
+	svn_commit_info_t *commit_info = NULL;
+	int itable = 3;
+	svn_boolean_t make_parents = FALSE;
+
+	checkpaths (L, 1);
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getboolfield(L, itable, "make_parents", -1, &make_parents);
+	}
+
+	init_function (&ctx, &pool, L, itable);
+
+	array = getpatharray (L, 1, pool);
+
+	if (svn_path_is_url (APR_ARRAY_IDX (array, 0, const char *))) {
+		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
+		ctx->log_msg_func2 = log_msg_func2;
+	}
+
+	err = svn_client_mkdir3 (&commit_info, array, make_parents, NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	if (commit_info == NULL) {
+		lua_pushnil (L);
+	} else {
+		lua_pushinteger (L, commit_info->revision);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_move (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	apr_array_header_t *arraypath;
+
+	const char *dest_path = luaL_checkstring (L, 2);
+	const char *message = (lua_gettop (L) < 3 || lua_isnil (L, 3)) ? "" : luaL_checkstring (L, 3);
+	int itable = 4;
+	svn_boolean_t force = FALSE;
+	svn_boolean_t move_as_child = FALSE;
+	svn_boolean_t make_parents = FALSE;
+	svn_commit_info_t *commit_info = NULL;
+	
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getboolfield(L, itable, "force", -1, &force);
+		getboolfield(L, itable, "move_as_child", -1, &move_as_child);
+		getboolfield(L, itable, "make_parents", -1, &make_parents);
+	} 
+
+	checkpaths (L, 1);
+
+	init_function (&ctx, &pool, L, itable);
+
+	arraypath = getpatharray (L, 1, pool);
+	dest_path = svn_path_canonicalize (dest_path, pool);
+
+	/* Many sources are moved, in one commit, into the destination */
+	if (arraypath->nelts > 1) {
+		move_as_child = TRUE;
+	}
+	
+	if (svn_path_is_url (dest_path)) {
+		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
+		ctx->log_msg_func2 = log_msg_func2;
+	}
+
+	err = svn_client_move5 (&commit_info, arraypath, dest_path, force,
+		   					move_as_child, make_parents, NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);	
+
+	if (commit_info == NULL) {
+		lua_pushnil (L);
+	} else {
+		lua_pushinteger (L, commit_info->revision);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_propget (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	apr_hash_t *props;
+	const char *propname_utf8;
+	const void *key;
+	void *val;
+	apr_hash_index_t *hi;
+	svn_opt_revision_t peg_revision;
+	svn_opt_revision_t revision;
+
+	const char *path = luaL_checkstring (L, 1);
+	const char *propname = luaL_checkstring (L, 2);
+	int itable = 4;
+	svn_depth_t depth = svn_depth_empty;
+	peg_revision.kind = svn_opt_revision_unspecified;
+
+	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
+		revision.kind = svn_opt_revision_unspecified;
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 3);
+	}
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	path = svn_path_canonicalize (path, pool);
+	
+	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	err = svn_client_propget3 (&props, propname_utf8, path, &peg_revision, &revision,
+							   NULL, depth, NULL, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	lua_newtable (L);
+
+	for (hi = apr_hash_first (pool, props); hi; hi = apr_hash_next (hi)) {
+	  svn_string_t *s;
+	  apr_hash_this (hi, &key, NULL, &val);
+	  s = (svn_string_t *) val;
+	  
+	  lua_pushstring (L, s->data);
+	  lua_setfield (L, -2, (char *) key);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+typedef struct proplist_bt {
+	lua_State *L;
+	callback_bt *cb;        /* function given to proplist_each, or NULL */
+} proplist_bt;
+
+
+static svn_error_t *
+proplist_receiver (void *baton, const char *path, apr_hash_t *prop_hash, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	const char *name_local;
+	proplist_bt *pb = baton;
+	lua_State *L = pb->L;
+	int is_url = svn_path_is_url (path);
+
+	if (is_url) {
+		name_local = svn_path_local_style (path, pool);
+	} else {
+		name_local = path;
+	}
+
+	lua_pushstring (L, name_local);
+	lua_newtable (L);
+
+	for (hi = apr_hash_first(pool, prop_hash); hi; hi = apr_hash_next (hi)) {
+		const void *key;
+		void *val;
+		const char *pname;
+		svn_string_t *pval;
+
+		apr_hash_this (hi, &key, NULL, &val);
+
+		pname = key;
+		pval = (svn_string_t *) val;
+
+		SVN_ERR (svn_cmdline_cstring_from_utf8 (&pname, pname, pool));
+
+		lua_pushlstring (L, pval->data, pval->len);
+		lua_setfield (L, -2, pname);
+	}
+
+	if (pb->cb != NULL) {
+		return call_callback (pb->cb, 2);
+	}
+
+	lua_settable (L, -3);
+
+	return SVN_NO_ERROR;
+}
+
+
+/* Lists the properties of PATH, with the options at ITABLE, into a
+   table or, when IFUNC is not 0, through the function at IFUNC */
+static int
+proplist_path (lua_State *L, int itable, int ifunc) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	svn_opt_revision_t peg_revision;
+	svn_opt_revision_t revision;
+	proplist_bt pb;
+	callback_bt cb;
+
+	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
+	svn_depth_t depth = svn_depth_empty;
 	peg_revision.kind = svn_opt_revision_unspecified;
 
-	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
-		revision.kind = svn_opt_revision_head;	
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		revision.kind = svn_opt_revision_unspecified;
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
+	}	
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+	}
+
+	init_function (&ctx, &pool, L, itable);
+
+	path = svn_path_canonicalize (path, pool);
+
+	pb.L = L;
+	pb.cb = NULL;
+	cb.L = L;
+	cb.ifunc = ifunc;
+	cb.failed = FALSE;
+
+	if (ifunc != 0) {
+		pb.cb = &cb;
+	} else {
+		lua_newtable (L);
+	}
+
+	err = svn_client_proplist3 (path, &peg_revision, &revision, depth,
+							 	NULL, proplist_receiver, &pb, ctx, pool);
+	IF_CALLBACK_ERROR_RETURN (cb, err, pool, L);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return ifunc != 0 ? 0 : 1;
+}
+
+
+static int
+l_proplist (lua_State *L) {
+	return proplist_path (L, 3, 0);
+}
+
+
+static int
+l_proplist_each (lua_State *L) {
+	luaL_checktype (L, 3, LUA_TFUNCTION);
+	return proplist_path (L, 4, 3);
+}
+
+
+static int
+l_propset (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	const char *path = luaL_checkstring (L, 1);
+	const char *propname = luaL_checkstring (L, 2);
+	const char *propval = lua_isnil (L, 3) ? NULL : luaL_checkstring (L, 3);
+	const char *propname_utf8 = NULL;
+	int itable = 4;
+	svn_depth_t depth = svn_depth_empty;
+	svn_boolean_t skip_checks = FALSE;
+
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "skip_checks", -1, &skip_checks);
+	} 
+
+	init_function (&ctx, &pool, L, itable);
+
+	path = svn_path_canonicalize (path, pool);
+
+	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	if (propval != NULL) {
+		svn_string_t *sstring = svn_string_create (propval, pool);
+		err = svn_client_propset3 (NULL, propname_utf8, sstring, path, depth, skip_checks,
+								   SVN_INVALID_REVNUM, NULL, NULL, ctx, pool);
+	} else {
+		err = svn_client_propset3 (NULL, propname_utf8, NULL, path, depth, skip_checks,
+								   SVN_INVALID_REVNUM, NULL, NULL, ctx, pool);
+	}
+	IF_ERROR_RETURN (err, pool, L);
+	
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+static int
+l_repos_create (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_repos_t *repos_p;
+	
+	const char *path = luaL_checkstring (L, 1);
+
+	if (init_pool (&pool) != 0) {
+		return init_pool_error (L);
+	}
+
+	path = svn_path_canonicalize (path, pool);
+
+	err = svn_repos_create (&repos_p, path, NULL, NULL, NULL, NULL, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+static int
+l_repos_delete (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	
+	const char *path = luaL_checkstring (L, 1);
+
+	if (init_pool (&pool) != 0) {
+		return init_pool_error (L);
+	}
+	
+	path = svn_path_canonicalize (path, pool);
+
+	err = svn_repos_delete (path, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return 0;
+}
+
+
+static int
+l_revprop_get (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	svn_opt_revision_t revision;
+	svn_string_t *propval;
+	svn_revnum_t rev;
+	svn_string_t *printable_val;
+
+	const char *url = luaL_checkstring (L, 1);
+	const char *propname = luaL_checkstring (L, 2);
+	const char *propname_utf8 = NULL;
+		
+	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
+		revision.kind = get_revision_kind (url);
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 3);
+	}
+
+	init_function (&ctx, &pool, L, 4);
+
+	url = svn_path_canonicalize (url, pool);
+
+	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	if (svn_path_is_url (url)) {
+		luasvn_client *client = get_client (L);
+		ra_session_entry *entry;
+
+		err = session_acquire (&entry, client, url, pool);
+		IF_ERROR_RETURN (err, pool, L);
+
+		err = session_revnum (&rev, entry->session, &revision, pool);
+		if (!err) {
+			err = svn_ra_rev_prop (entry->session, rev, propname_utf8, &propval, pool);
+		}
+		session_release (client, entry, err);
+	} else {
+		err = svn_client_revprop_get (propname_utf8, &propval, url, &revision, &rev, ctx, pool);
+	}
+	IF_ERROR_RETURN (err, pool, L);
+
+	if (propval == NULL) {
+		lua_pushnil (L);
+		svn_pool_destroy (pool);
+		return 1;
+	}
+
+	printable_val = propval;
+	if (svn_prop_needs_translation (propname_utf8)) {
+		err = svn_subst_detranslate_string (&printable_val, propval, TRUE, pool);
+		IF_ERROR_RETURN (err, pool, L);
+	}
+
+	lua_pushstring (L, printable_val->data);
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_revprop_list (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	apr_hash_t *entries;
+	apr_hash_index_t *hi;
+	void *val;
+	const void *key;
+	svn_revnum_t rev;
+	svn_opt_revision_t revision;
+	
+	const char *url = luaL_checkstring (L, 1);
+
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		revision.kind = get_revision_kind (url);
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
+	}
+
+	init_function (&ctx, &pool, L, 3);
+
+	url = svn_path_canonicalize (url, pool);
+
+	if (svn_path_is_url (url)) {
+		luasvn_client *client = get_client (L);
+		ra_session_entry *entry;
+
+		err = session_acquire (&entry, client, url, pool);
+		IF_ERROR_RETURN (err, pool, L);
+
+		err = session_revnum (&rev, entry->session, &revision, pool);
+		if (!err) {
+			err = svn_ra_rev_proplist (entry->session, rev, &entries, pool);
+		}
+		session_release (client, entry, err);
+	} else {
+		err = svn_client_revprop_list (&entries, url, &revision, &rev, ctx, pool);
+	}
+	IF_ERROR_RETURN (err, pool, L);
+
+	lua_newtable (L);
+
+	for (hi = apr_hash_first (pool, entries); hi; hi = apr_hash_next (hi)) {
+		const char *pname;
+		svn_string_t *pval;
+
+		apr_hash_this (hi, &key, NULL, &val);
+	
+		pname = key;
+
+		pval = (svn_string_t *) val;
+		if (svn_prop_needs_translation (pname)) {
+			err = svn_subst_translate_string (&pval, pval, APR_LOCALE_CHARSET, pool);
+			IF_ERROR_RETURN (err, pool, L);
+		}
+
+		err = svn_cmdline_cstring_from_utf8 (&pname, pname, pool);
+		IF_ERROR_RETURN (err, pool, L);
+
+		lua_pushstring (L, pval->data);
+		lua_setfield (L, -2, pname);
+	}
+
+	svn_pool_destroy (pool);
+	return 1;
+}
+
+
+static int
+l_revprop_set (lua_State *L) {
+	apr_pool_t *pool;
+	svn_error_t *err;
+	svn_client_ctx_t *ctx;
+
+	svn_opt_revision_t revision;
+   	svn_revnum_t rev;	
+	
+	const char *url = luaL_checkstring (L, 1);
+	const char *propname = luaL_checkstring (L, 2);
+	const char *propval = lua_isnil (L, 3) ? NULL : luaL_checkstring (L, 3);
+	const char *propname_utf8 = NULL;
+	int itable = 5;
+	svn_boolean_t force = FALSE;
+
+	if (lua_gettop (L) < 4 || lua_isnil (L, 4)) {
+		revision.kind = get_revision_kind (url);
 	} else {
 		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 3);
+		revision.value.number = lua_tointeger (L, 4);
 	}
-	
+
 	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
-		getboolfield(L, itable, "allow_obstructions", -1, &obstructions);
+		getboolfield(L, itable, "force", -1, &force);
 	} 
 
-	init_function (&ctx, &pool, L);
+	init_function (&ctx, &pool, L, itable);
 
-	path = svn_path_canonicalize (path, pool);
-	dir = svn_path_canonicalize (dir, pool);
+	url = svn_path_canonicalize (url, pool);
+
+	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	if (propval != NULL) {
+		svn_string_t *sstring = svn_string_create (propval, pool);
+
+		if (svn_prop_needs_translation (propname_utf8)) {
+			err = svn_subst_translate_string (&sstring, sstring, APR_LOCALE_CHARSET, pool);
+			IF_ERROR_RETURN (err, pool, L);
+		}
 	
-	err = svn_client_checkout3 (&rev, path, dir, &peg_revision, &revision, depth,
-								ignore_externals, obstructions, ctx, pool);
+		err = svn_client_revprop_set2 (propname_utf8, sstring, NULL, url, &revision, &rev, force, ctx, pool);
+	} else {
+		err = svn_client_revprop_set2 (propname_utf8, NULL, NULL, url, &revision, &rev, force, ctx, pool);
+	}
 	IF_ERROR_RETURN (err, pool, L);
 	
-	lua_pushinteger (L, rev);
-
 	svn_pool_destroy (pool);
-	return 1;
+	return 0;
 }
 
 
-static int
-l_cleanup (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+typedef struct status_bt {
+	lua_State *L;
+	callback_bt *cb;        /* function given to status_each, or NULL */
+	svn_boolean_t detailed;
+	svn_boolean_t show_last_committed;
+	svn_boolean_t repos_locks;
+	svn_boolean_t structured;   /* records instead of lines, see push_status */
+} status_bt;
+
+
+/* ====================================================================
+ * Copyright (c) 2000-2004 CollabNet.  All rights reserved.
+ * 
+ * The code of "generate_status_code" is from status.c
+ * "print_status" is based on the code of the function with the
+ * same name in status.c
+ */
+
+
+/* Return the single character representation of STATUS */
+static char
+generate_status_code(enum svn_wc_status_kind status)
+{
+  	switch (status)
+  	{
+	  	case svn_wc_status_none:        return ' ';
+		case svn_wc_status_normal:      return ' ';
+		case svn_wc_status_added:       return 'A';
+		case svn_wc_status_missing:     return '!';
+		case svn_wc_status_incomplete:  return '!';
+		case svn_wc_status_deleted:     return 'D';
+		case svn_wc_status_replaced:    return 'R';
+		case svn_wc_status_modified:    return 'M';
+		case svn_wc_status_merged:      return 'G';
+		case svn_wc_status_conflicted:  return 'C';
+		case svn_wc_status_obstructed:  return '~';
+		case svn_wc_status_ignored:     return 'I';
+		case svn_wc_status_external:    return 'X';
+		case svn_wc_status_unversioned: return '?';
+		default:                        return '?';
+	}
+}
 
-	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
 
-	init_function (&ctx, &pool, L);
+/* Print STATUS and PATH in a format determined by DETAILED and
+   SHOW_LAST_COMMITTED. */
+static svn_error_t *
+print_status(const char *path,
+             svn_boolean_t detailed,
+             svn_boolean_t show_last_committed,
+             svn_boolean_t repos_locks,
+             svn_wc_status2_t *status,
+             lua_State *L,
+			 apr_pool_t *pool)
+{	
+	const char *info;
 	
-	path = svn_path_canonicalize (path, pool);
+	if (detailed)
+	{
+		char ood_status, lock_status;
+		const char *working_rev;
 
-	err = svn_client_cleanup (path, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+		if (! status->entry)
+			working_rev = "";
+		else if (! SVN_IS_VALID_REVNUM(status->entry->revision))
+			working_rev = " ? ";
+		else if (status->copied)
+			working_rev = "-";
+		else
+			working_rev = apr_psprintf(pool, "%ld", status->entry->revision);
+
+		if (status->repos_text_status != svn_wc_status_none
+				|| status->repos_prop_status != svn_wc_status_none)
+			ood_status = '*';
+		else
+			ood_status = ' ';
+
+		if (repos_locks)
+		{
+		   	if (status->repos_lock)
+		   	{
+			 	if (status->entry && status->entry->lock_token)
+			 	{
+			   		if (strcmp(status->repos_lock->token, status->entry->lock_token)
+					 		== 0)
+						lock_status = 'K';
+					else
+						lock_status = 'T';
+				}
+				else
+					lock_status = 'O';
+			}
+			else if (status->entry && status->entry->lock_token)
+				lock_status = 'B';
+			else
+				lock_status = ' ';
+		}
+		else
+			lock_status = (status->entry && status->entry->lock_token) ? 'K' : ' ';
+
+
+		if (show_last_committed)
+		{
+		   	const char *commit_rev;
+			const char *commit_author;
+
+			if (status->entry && SVN_IS_VALID_REVNUM(status->entry->cmt_rev))
+				commit_rev = apr_psprintf(pool, "%ld", status->entry->cmt_rev);
+			else if (status->entry) 
+				commit_rev = " ? ";
+			else 
+				commit_rev = "";
+
+
+			if (status->entry && status->entry->cmt_author)
+				commit_author = status->entry->cmt_author;
+			else if (status->entry)
+				commit_author = " ? ";
+			else
+				commit_author = "";
+
+
+			info = apr_psprintf(pool, 			
+					"%c%c%c%c%c%c %c   %6s   %6s %-12s %s",
+					generate_status_code(status->text_status),
+					generate_status_code(status->prop_status),
+					status->locked ? 'L' : ' ',
+					status->copied ? '+' : ' ',
+					status->switched ? 'S' : ' ',
+					lock_status,
+					ood_status,
+					working_rev,
+					commit_rev,
+					commit_author,
+					path);
+
+		}
+		else {
+			info = apr_psprintf(pool, 
+					"%c%c%c%c%c%c %c   %6s   %s\n",
+					generate_status_code(status->text_status),
+					generate_status_code(status->prop_status),
+					status->locked ? 'L' : ' ',
+					status->copied ? '+' : ' ',
+					status->switched ? 'S' : ' ',
+					lock_status,
+					ood_status,
+					working_rev,
+					path);
+		}
+	}
+	else {
+		info = apr_psprintf(pool,
+			   	"%c%c%c%c%c%c %s\n",
+				generate_status_code(status->text_status),
+				generate_status_code(status->prop_status),
+				status->locked ? 'L' : ' ',
+				status->copied ? '+' : ' ',
+				status->switched ? 'S' : ' ',
+				((status->entry && status->entry->lock_token)
+				 ? 'K' : ' '),
+				path);
+	}
+
+	lua_pushstring (L, info);
+	return SVN_NO_ERROR;
+}
+
+
+/* Pushes the record describing STATUS. The states are numbers, named by
+   svn.status_kinds, and the revisions and flags are numbers and
+   booleans. Fields that do not apply to the entry are left out. */
+static void
+push_status (lua_State *L, svn_wc_status2_t *status) {
+	const svn_wc_entry_t *entry = status->entry;
+
+	lua_createtable (L, 0, 13);
+
+	lua_pushinteger (L, status->text_status);
+	lua_setfield (L, -2, "text_status");
+
+	lua_pushinteger (L, status->prop_status);
+	lua_setfield (L, -2, "prop_status");
+
+	lua_pushinteger (L, status->repos_text_status);
+	lua_setfield (L, -2, "repos_text_status");
+
+	lua_pushinteger (L, status->repos_prop_status);
+	lua_setfield (L, -2, "repos_prop_status");
+
+	lua_pushboolean (L, status->locked);
+	lua_setfield (L, -2, "locked");
+
+	lua_pushboolean (L, status->copied);
+	lua_setfield (L, -2, "copied");
+
+	lua_pushboolean (L, status->switched);
+	lua_setfield (L, -2, "switched");
+
+	lua_pushboolean (L, status->repos_text_status != svn_wc_status_none
+					 || status->repos_prop_status != svn_wc_status_none);
+	lua_setfield (L, -2, "out_of_date");
+
+	lua_pushboolean (L, status->repos_lock != NULL);
+	lua_setfield (L, -2, "repos_locked");
+
+	if (entry == NULL) {
+		return;
+	}
+
+	lua_pushboolean (L, entry->lock_token != NULL);
+	lua_setfield (L, -2, "lock_owned");
+
+	if (SVN_IS_VALID_REVNUM (entry->revision)) {
+		lua_pushinteger (L, entry->revision);
+		lua_setfield (L, -2, "revision");
+	}
+
+	if (SVN_IS_VALID_REVNUM (entry->cmt_rev)) {
+		lua_pushinteger (L, entry->cmt_rev);
+		lua_setfield (L, -2, "changed_rev");
+	}
+
+	if (entry->cmt_author != NULL) {
+		lua_pushstring (L, entry->cmt_author);
+		lua_setfield (L, -2, "changed_author");
+	}
+}
+
+
+/* Names of the states of push_status */
+static const struct {
+	const char *name;
+	enum svn_wc_status_kind kind;
+} status_kinds [] = {
+	{"none", svn_wc_status_none},
+	{"unversioned", svn_wc_status_unversioned},
+	{"normal", svn_wc_status_normal},
+	{"added", svn_wc_status_added},
+	{"missing", svn_wc_status_missing},
+	{"deleted", svn_wc_status_deleted},
+	{"replaced", svn_wc_status_replaced},
+	{"modified", svn_wc_status_modified},
+	{"merged", svn_wc_status_merged},
+	{"conflicted", svn_wc_status_conflicted},
+	{"ignored", svn_wc_status_ignored},
+	{"obstructed", svn_wc_status_obstructed},
+	{"external", svn_wc_status_external},
+	{"incomplete", svn_wc_status_incomplete},
+	{NULL, 0}
+};
+
+
+static svn_error_t *
+status_func (void *baton, const char *path, svn_wc_status2_t *status, apr_pool_t *pool) {
+	struct status_bt *sb = baton;
+	lua_State *L = sb->L;
+
+	path = svn_path_local_style (path, pool);
 	
-	svn_pool_destroy (pool);
-	return 0;
+	if (sb->structured) {
+		push_status (L, status);
+	} else {
+		print_status (path, sb->detailed, sb->show_last_committed, sb->repos_locks,
+					  status, L, pool);
+	}
+
+	if (sb->cb != NULL) {
+		lua_pushstring (L, path);
+		lua_insert (L, -2);
+		return call_callback (sb->cb, 2);
+	}
+
+	lua_setfield (L, -2, path);
+	return SVN_NO_ERROR;	
 }
 
 
+/* Gets the status of PATH, with the options at ITABLE, into a table
+   or, when IFUNC is not 0, through the function at IFUNC */
 static int
-l_commit (lua_State *L) {
+status_path (lua_State *L, int itable, int ifunc) {
 	apr_pool_t *pool;
 	svn_error_t *err;
 	svn_client_ctx_t *ctx;
-
+	
+	svn_revnum_t rev;	
+	status_bt baton;
+	callback_bt cb;
+	svn_opt_revision_t revision;
 	apr_array_header_t *array;
-
-	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
-	const char *message = (lua_gettop (L) < 2 || lua_isnil (L, 2)) ? "" : luaL_checkstring (L, 2);
-	int itable = 3;
-	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t keep_locks = FALSE;
-	svn_commit_info_t *commit_info = NULL;
+	apr_pool_t *iterpool;
+	int i;
 	
+	svn_depth_t depth = svn_depth_infinity;
+	svn_boolean_t verbose = FALSE;
+	svn_boolean_t show_updates = FALSE;
+	svn_boolean_t no_ignore = FALSE;
+	svn_boolean_t ignore_externals = FALSE;
+	svn_boolean_t structured = FALSE;
+
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		revision.kind = svn_opt_revision_head;
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
+	}
+
 	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
 		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "keep_locks", -1, &keep_locks);
+		getboolfield(L, itable, "verbose", -1, &verbose);
+		getboolfield(L, itable, "show_updates", -1, &show_updates);
+		getboolfield(L, itable, "no_ignore", -1, &no_ignore);
+		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
+		getboolfield(L, itable, "structured", -1, &structured);
 	} 
 
-	init_function (&ctx, &pool, L);
+	if (!lua_isnoneornil (L, 1)) {
+		checkpaths (L, 1);
+	}
 
-	path = svn_path_canonicalize (path, pool);
+	init_function (&ctx, &pool, L, itable);
 
-	array = apr_array_make (pool, 1, sizeof (const char *));
-	(*((const char **) apr_array_push (array))) = path;
+	if (lua_isnoneornil (L, 1)) {
+		array = apr_array_make (pool, 1, sizeof (const char *));
+		APR_ARRAY_PUSH (array, const char *) = "";
+	} else {
+		array = getpatharray (L, 1, pool);
+	}
 
-	make_log_msg_baton (&(ctx->log_msg_baton2), message, path, ctx->config, pool, L);
-	
-	ctx->log_msg_func2 = log_msg_func2;
+	baton.L = L;
+	baton.cb = NULL;
+	baton.detailed = (verbose || show_updates);
+	baton.show_last_committed = verbose;
+	baton.repos_locks = show_updates;
+	baton.structured = structured;
 
-	err = svn_client_commit4 (&commit_info, array, depth, keep_locks,
-							  FALSE, NULL, NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);	
+	cb.L = L;
+	cb.ifunc = ifunc;
+	cb.failed = FALSE;
 
-	if (commit_info == NULL) {
-		lua_pushnil (L);
+	if (ifunc != 0) {
+		baton.cb = &cb;
 	} else {
-		lua_pushinteger (L, commit_info->revision);
+		lua_newtable (L);
+	}
+
+	/* The entries of all the paths go to the same table */
+	iterpool = svn_pool_create (pool);
+	err = SVN_NO_ERROR;
+	for (i = 0; i < array->nelts && !err; i++) {
+		svn_pool_clear (iterpool);
+		err = svn_client_status4 (&rev, APR_ARRAY_IDX (array, i, const char *), &revision,
+								  status_func, &baton, depth, verbose, show_updates,
+								  no_ignore, ignore_externals, NULL, ctx, iterpool);
 	}
+	IF_CALLBACK_ERROR_RETURN (cb, err, pool, L);
+	IF_ERROR_RETURN (err, pool, L);
 
 	svn_pool_destroy (pool);
-	return 1;
+	return ifunc != 0 ? 0 : 1;
 }
 
 
 static int
-l_copy (lua_State *L) {
+l_status (lua_State *L) {
+	return status_path (L, 3, 0);
+}
+
+
+static int
+l_status_each (lua_State *L) {
+	luaL_checktype (L, 3, LUA_TFUNCTION);
+	return status_path (L, 4, 3);
+}
+
+
+/* What a transaction does to a path besides deleting it */
+enum txn_action {
+	txn_op_none,            /* only properties are changed */
+	txn_op_put,
+	txn_op_mkdir,
+	txn_op_copy
+};
+
+/* The changes made to a path by a transaction */
+typedef struct txn_op {
+	enum txn_action action;
+	svn_boolean_t deleted;      /* the path is deleted first */
+	svn_string_t *content;      /* contents given to put */
+	const char *copyfrom_url;
+	svn_revnum_t copyfrom_rev;
+	svn_node_kind_t kind;       /* kind of the node, found on commit */
+	apr_hash_t *props;          /* name -> svn_string_t, NULL deletes it */
+} txn_op;
+
+/* A commit built in memory and sent through the commit editor of an RA
+   session, without a working copy, see svn.txn */
+typedef struct txn_t {
 	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-	
-	apr_array_header_t *arraysource;
-	svn_opt_revision_t revision;
- 	svn_client_copy_source_t copy_source;
- 
-	const char *src_path = luaL_checkstring (L, 1);
-	const char *dest_path = luaL_checkstring (L, 2);
-	const char *message = NULL;
-	int itable = 5;
-	svn_commit_info_t *commit_info = NULL;
-	svn_boolean_t child = FALSE;
-	svn_boolean_t parents = FALSE;
-	svn_boolean_t ignore_externals = FALSE;
+	luasvn_client *client;
+	const char *url;
+	const char *message;
+	apr_hash_t *ops;            /* path relative to url -> txn_op */
+} txn_t;
 
-	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
-		revision.kind = svn_opt_revision_unspecified;
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 3);
-	}	
+#define LUASVN_TXN "luasvn.txn"
 
-	message = (lua_gettop (L) < 4 || lua_isnil (L, 4)) ? "" : luaL_checkstring (L, 4);
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getboolfield(L, itable, "copy_as_child", -1, &child);
-		getboolfield(L, itable, "make_parents", -1, &parents);
-		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
-	} 
+/* Baton of the path driver of a transaction */
+typedef struct txn_edit_bt {
+	txn_t *txn;
+	const svn_delta_editor_t *editor;
+	void *edit_baton;
+	svn_revnum_t base_rev;
+} txn_edit_bt;
 
-	init_function (&ctx, &pool, L);
 
-	src_path = svn_path_canonicalize (src_path, pool);
-	dest_path = svn_path_canonicalize (dest_path, pool);
+static txn_t *
+check_txn (lua_State *L) {
+	txn_t *txn = luaL_checkudata (L, 1, LUASVN_TXN);
 
-	arraysource = apr_array_make(pool, 1, sizeof(const svn_client_copy_source_t *));
-	copy_source.path = src_path;
- 	copy_source.revision = &revision;
-  	copy_source.peg_revision = &revision;
-	APR_ARRAY_PUSH(arraysource, const svn_client_copy_source_t *) = &copy_source;
+	if (txn->pool == NULL) {
+		send_error (L, "Transaction is closed\n");
+	}
+	return txn;
+}
 
-	if (svn_path_is_url (dest_path)) {
-		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
-		ctx->log_msg_func2 = log_msg_func2;
+
+/* Gets the changes of the path at INDEX, the path being relative to the
+   URL of the transaction */
+static txn_op *
+txn_get_op (lua_State *L, txn_t *txn, int index, svn_boolean_t allow_root) {
+	const char *path = luaL_checkstring (L, index);
+	txn_op *op;
+
+	while (*path == '/') {
+		path++;
 	}
+	path = svn_path_canonicalize (path, txn->pool);
 
-	err = svn_client_copy5 (&commit_info, arraysource, dest_path, child, parents,
-		   					ignore_externals, NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);	
+	if (!allow_root && *path == '\0') {
+		send_error (L, "The root of the transaction can't be changed\n");
+	}
 
-	if (commit_info == NULL) {
-		lua_pushnil (L);
-	} else {
-		lua_pushinteger (L, commit_info->revision);
+	op = apr_hash_get (txn->ops, path, APR_HASH_KEY_STRING);
+	if (op == NULL) {
+		op = apr_pcalloc (txn->pool, sizeof (txn_op));
+		op->action = txn_op_none;
+		op->copyfrom_rev = SVN_INVALID_REVNUM;
+		apr_hash_set (txn->ops, path, APR_HASH_KEY_STRING, op);
 	}
+	return op;
+}
 
-	svn_pool_destroy (pool);
-	return 1;
+
+static int
+txn_put (lua_State *L) {
+	txn_t *txn = check_txn (L);
+	txn_op *op = txn_get_op (L, txn, 2, FALSE);
+	size_t len;
+	const char *content = luaL_checklstring (L, 3, &len);
+
+	/* A copied file keeps its history and gets the new contents */
+	if (op->action != txn_op_copy) {
+		op->action = txn_op_put;
+	}
+	op->content = svn_string_ncreate (content, len, txn->pool);
+	return 0;
 }
 
 
 static int
-l_delete (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+txn_mkdir (lua_State *L) {
+	txn_t *txn = check_txn (L);
+	txn_op *op = txn_get_op (L, txn, 2, FALSE);
 
-	apr_array_header_t *array;
-	
-	const char *path = luaL_checkstring (L, 1);
-	const char *message = (lua_gettop (L) < 2 || lua_isnil (L, 2)) ? "" : luaL_checkstring (L, 2);
-	int itable = 3;
-	svn_boolean_t force = FALSE;
-	svn_boolean_t keep_local = FALSE;
-	svn_commit_info_t *commit_info = NULL;
+	op->action = txn_op_mkdir;
+	op->content = NULL;
+	return 0;
+}
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getboolfield(L, itable, "force", -1, &force);
-		getboolfield(L, itable, "keep_local", -1, &keep_local);
-	} 
 
-	init_function (&ctx, &pool, L);
+static int
+txn_delete (lua_State *L) {
+	txn_t *txn = check_txn (L);
+	txn_op *op = txn_get_op (L, txn, 2, FALSE);
+
+	op->action = txn_op_none;
+	op->deleted = TRUE;
+	op->content = NULL;
+	op->props = NULL;
+	return 0;
+}
 
-	path = svn_path_canonicalize (path, pool);
 
-	array = apr_array_make (pool, 1, sizeof (const char *));
-	(*((const char **) apr_array_push (array))) = path;
+static int
+txn_copy (lua_State *L) {
+	txn_t *txn = check_txn (L);
+	const char *src = luaL_checkstring (L, 2);
+	txn_op *op = txn_get_op (L, txn, 4, FALSE);
+
+	if (!svn_path_is_url (src)) {
+		while (*src == '/') {
+			src++;
+		}
+		src = svn_path_url_add_component2 (txn->url, src, txn->pool);
+	}
 
-	lua_newtable (L);
+	op->action = txn_op_copy;
+	op->content = NULL;
+	op->copyfrom_url = svn_path_canonicalize (src, txn->pool);
+	op->copyfrom_rev = lua_isnoneornil (L, 3) ? SVN_INVALID_REVNUM : lua_tointeger (L, 3);
+	return 0;
+}
 
-	if (svn_path_is_url (path)) {
-		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
-		ctx->log_msg_func2 = log_msg_func2;
+
+static int
+txn_propset (lua_State *L) {
+	txn_t *txn = check_txn (L);
+	txn_op *op = txn_get_op (L, txn, 2, TRUE);
+	const char *propname = luaL_checkstring (L, 3);
+	const char *propval = lua_isnoneornil (L, 4) ? NULL : luaL_checkstring (L, 4);
+	const char *propname_utf8;
+	svn_string_t *sstring = NULL;
+	svn_error_t *err;
+	apr_pool_t *pool;
+
+	if (op->deleted && op->action == txn_op_none) {
+		return send_error (L, "Can't set a property of a deleted path\n");
 	}
 
-	err = svn_client_delete3 (&commit_info, array, force, keep_local, NULL, ctx, pool);
+	pool = svn_pool_create (txn->pool);
+
+	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, txn->pool);
 	IF_ERROR_RETURN (err, pool, L);
 
-	if (commit_info == NULL) {
-		lua_pushnil (L);
-	} else {
-		lua_pushinteger (L, commit_info->revision);
+	if (propval != NULL) {
+		sstring = svn_string_create (propval, txn->pool);
+		if (svn_prop_needs_translation (propname_utf8)) {
+			err = svn_subst_translate_string (&sstring, sstring, APR_LOCALE_CHARSET, txn->pool);
+			IF_ERROR_RETURN (err, pool, L);
+		}
 	}
-	
+
+	if (op->props == NULL) {
+		op->props = apr_hash_make (txn->pool);
+	}
+	apr_hash_set (op->props, propname_utf8, APR_HASH_KEY_STRING, sstring);
+
 	svn_pool_destroy (pool);
-	return 1;
+	return 0;
 }
 
 
-static int
-l_diff (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+/* Finds the kind of the node changed by OP at PATH, relative to the
+   repository root of SESSION */
+static svn_error_t *
+txn_check_op (svn_ra_session_t *session, const char *root, const char *path,
+			  txn_op *op, svn_revnum_t head, apr_pool_t *pool) {
+	const char *src;
+
+	switch (op->action) {
+	case txn_op_mkdir:
+		op->kind = svn_node_dir;
+		return SVN_NO_ERROR;
+
+	case txn_op_copy:
+		if (!SVN_IS_VALID_REVNUM (op->copyfrom_rev)) {
+			op->copyfrom_rev = head;
+		}
+		src = svn_path_is_child (root, op->copyfrom_url, pool);
+		if (src == NULL) {
+			return svn_error_createf (SVN_ERR_BAD_URL, NULL,
+					"'%s' is not in the repository of the transaction",
+					op->copyfrom_url);
+		}
+		SVN_ERR (svn_ra_check_path (session, svn_path_uri_decode (src, pool),
+					op->copyfrom_rev, &op->kind, pool));
+		if (op->kind == svn_node_none) {
+			return svn_error_createf (SVN_ERR_FS_NOT_FOUND, NULL,
+					"'%s' not found in revision %ld", op->copyfrom_url, op->copyfrom_rev);
+		}
+		if (op->content != NULL && op->kind != svn_node_file) {
+			return svn_error_createf (SVN_ERR_FS_NOT_FILE, NULL,
+					"'%s' is not a file", op->copyfrom_url);
+		}
+		return SVN_NO_ERROR;
 
-	apr_file_t *aprout;
-	apr_file_t *aprerr;
-	apr_status_t status;
-	apr_array_header_t *array;
-	svn_opt_revision_t rev1;
-	svn_opt_revision_t rev2;
+	case txn_op_put:
+		/* A replaced node is added back as a file */
+		if (op->deleted) {
+			op->kind = svn_node_none;
+			return SVN_NO_ERROR;
+		}
+		SVN_ERR (svn_ra_check_path (session, path, head, &op->kind, pool));
+		if (op->kind == svn_node_dir) {
+			return svn_error_createf (SVN_ERR_FS_NOT_FILE, NULL,
+					"'%s' is a directory", path);
+		}
+		return SVN_NO_ERROR;
 
-	const char *path1 = NULL;
-	const char *path2 = NULL;
-	const char *outfile = NULL;	
-	const char *errfile = NULL;
-	int itable = 7;
-	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t ignore_ancestry = TRUE;
-	svn_boolean_t no_diff_deleted = FALSE;
-	svn_boolean_t force = FALSE;
-	
-	path1 = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
-		
-	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		rev1.kind = get_revision_kind (path1);
-	} else {
-		rev1.kind = svn_opt_revision_number;
-		rev1.value.number = lua_tointeger (L, 2);
+	default:
+		if (op->deleted) {
+			return SVN_NO_ERROR;
+		}
+		SVN_ERR (svn_ra_check_path (session, path, head, &op->kind, pool));
+		if (op->kind == svn_node_none) {
+			return svn_error_createf (SVN_ERR_FS_NOT_FOUND, NULL,
+					"'%s' not found", path);
+		}
+		return SVN_NO_ERROR;
 	}
-	
-	path2 = (lua_gettop (L) < 3 || lua_isnil (L, 3)) ? path1 : luaL_checkstring (L, 3);
+}
 
-	if (lua_gettop (L) < 4 || lua_isnil (L, 4)) {
-		if (svn_path_is_url (path2)) {
-			rev2.kind = svn_opt_revision_head;
+
+static svn_error_t *
+txn_change_props (const svn_delta_editor_t *editor, void *baton,
+				  svn_boolean_t is_dir, apr_hash_t *props, apr_pool_t *pool) {
+	apr_hash_index_t *hi;
+
+	if (props == NULL) {
+		return SVN_NO_ERROR;
+	}
+
+	for (hi = apr_hash_first (pool, props); hi; hi = apr_hash_next (hi)) {
+		const void *key;
+		void *val;
+
+		apr_hash_this (hi, &key, NULL, &val);
+		if (is_dir) {
+			SVN_ERR (editor->change_dir_prop (baton, key, val, pool));
 		} else {
-			rev2.kind = svn_opt_revision_working;
+			SVN_ERR (editor->change_file_prop (baton, key, val, pool));
 		}
-	} else {
-		rev2.kind = svn_opt_revision_number;
-		rev2.value.number = lua_tointeger (L, 4);
 	}
+	return SVN_NO_ERROR;
+}
 
-	outfile = (lua_gettop (L) < 5 || lua_isnil (L, 5)) ? NULL : luaL_checkstring (L, 5);
-	
-	errfile = (lua_gettop (L) < 6 || lua_isnil (L, 6)) ? NULL : luaL_checkstring (L, 6);
-	
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "ignore_ancestry", -1, &ignore_ancestry);
-		getboolfield(L, itable, "no_diff_deleted", -1, &no_diff_deleted);
-		getboolfield(L, itable, "force", -1, &force);
-	} 
-
-	init_function (&ctx, &pool, L);
 
-	path1 = svn_path_canonicalize (path1, pool);
-	path2 = svn_path_canonicalize (path2, pool);
+/* Called by svn_delta_path_driver for each changed path */
+static svn_error_t *
+txn_path_driver (void **dir_baton, void *parent_baton, void *callback_baton,
+				 const char *path, apr_pool_t *pool) {
+	txn_edit_bt *eb = callback_baton;
+	const svn_delta_editor_t *editor = eb->editor;
+	txn_op *op = apr_hash_get (eb->txn->ops, path, APR_HASH_KEY_STRING);
+	void *file_baton;
+
+	*dir_baton = NULL;
+
+	/* The driver leaves the root to us when it has changes */
+	if (parent_baton == NULL) {
+		SVN_ERR (editor->open_root (eb->edit_baton, eb->base_rev, pool, dir_baton));
+		return txn_change_props (editor, *dir_baton, TRUE, op->props, pool);
+	}
 
-	if (outfile) {
-		status = apr_file_open (&aprout, outfile, APR_READ | APR_WRITE | APR_CREATE,
-				                APR_OS_DEFAULT, pool);
-	} else {
-		status = apr_file_open_stdout(&aprout, pool);
+	if (op->deleted) {
+		SVN_ERR (editor->delete_entry (path, eb->base_rev, parent_baton, pool));
+	}
+
+	if (op->kind == svn_node_dir) {
+		if (op->action == txn_op_none) {
+			SVN_ERR (editor->open_directory (path, parent_baton, eb->base_rev,
+											 pool, dir_baton));
+		} else {
+			SVN_ERR (editor->add_directory (path, parent_baton, op->copyfrom_url,
+											op->copyfrom_rev, pool, dir_baton));
+		}
+		return txn_change_props (editor, *dir_baton, TRUE, op->props, pool);
 	}
-	if (status) {
-		IF_ERROR_RETURN (svn_error_wrap_apr(status, "Can't open output file"), pool, L);
+
+	if (op->action == txn_op_none && op->deleted) {
+		return SVN_NO_ERROR;
 	}
 
-	if (errfile) {
-		status = apr_file_open (&aprerr, errfile, APR_READ | APR_WRITE | APR_CREATE,
-				                APR_OS_DEFAULT, pool);
+	if (op->action == txn_op_copy || op->deleted || op->kind != svn_node_file) {
+		SVN_ERR (editor->add_file (path, parent_baton, op->copyfrom_url,
+								   op->copyfrom_rev, pool, &file_baton));
 	} else {
-		status = apr_file_open_stderr(&aprerr, pool);
+		SVN_ERR (editor->open_file (path, parent_baton, eb->base_rev,
+									pool, &file_baton));
 	}
-	if (status) {
-		IF_ERROR_RETURN (svn_error_wrap_apr(status, "Can't open error file"), pool , L);
+
+	if (op->content != NULL) {
+		svn_txdelta_window_handler_t handler;
+		void *handler_baton;
+
+		SVN_ERR (editor->apply_textdelta (file_baton, NULL, pool,
+										  &handler, &handler_baton));
+		SVN_ERR (svn_txdelta_send_string (op->content, handler, handler_baton, pool));
 	}
 
-	array = apr_array_make (pool, 0, sizeof (const char *));
+	SVN_ERR (txn_change_props (editor, file_baton, FALSE, op->props, pool));
+	return editor->close_file (file_baton, NULL, pool);
+}
 
-	err = svn_client_diff4 (array, path1, &rev1, path2, &rev2, NULL,
-			                depth, ignore_ancestry, no_diff_deleted, force,
-							APR_LOCALE_CHARSET, aprout, aprerr, NULL,
-							ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);	
 
-	svn_pool_destroy (pool);
-	return 0;
+static svn_error_t *
+txn_commit_callback (const svn_commit_info_t *commit_info, void *baton, apr_pool_t *pool) {
+	*((svn_revnum_t *) baton) = commit_info->revision;
+	return SVN_NO_ERROR;
 }
 
 
-static int
-l_import (lua_State *L) {
-	apr_pool_t *pool;
+/* Sends the changes of TXN through SESSION, which is open on its URL */
+static svn_error_t *
+txn_drive (txn_t *txn, svn_ra_session_t *session, svn_revnum_t *revision,
+		   apr_pool_t *pool) {
+	txn_edit_bt eb;
+	apr_hash_t *revprops;
+	apr_array_header_t *paths;
+	apr_hash_index_t *hi;
+	const char *root, *base;
 	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-	
-	const char *path = lua_isnil (L, 1) ? "" : luaL_checkstring (L, 1);
-	const char *url = luaL_checkstring (L, 2);
-	const char *message = (lua_gettop (L) < 3 || lua_isnil (L, 3)) ? "" : luaL_checkstring (L, 3);
-	int itable = 4;
-	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t no_ignore = FALSE;
-	svn_boolean_t ignore_unknown = FALSE;
-	svn_commit_info_t *commit_info = NULL;
-	
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "no_ignore", -1, &no_ignore);
-		getboolfield(L, itable, "ignore_unknown_node_types", -1, &ignore_unknown);
-	} 
 
-	init_function (&ctx, &pool, L);
-
-	path = svn_path_canonicalize (path, pool);
-	url = svn_path_canonicalize (url, pool);
+	SVN_ERR (svn_ra_get_repos_root (session, &root, pool));
+	SVN_ERR (svn_ra_get_latest_revnum (session, &eb.base_rev, pool));
 
-	make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
-	ctx->log_msg_func2 = log_msg_func2;
+	base = svn_path_is_child (root, txn->url, pool);
+	base = base ? svn_path_uri_decode (base, pool) : "";
 
-	err = svn_client_import3 (&commit_info, path, url, depth, no_ignore, ignore_unknown,
-							  NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	/* The kinds of the nodes are found before the edit, since a session
+	   can't be used while its commit editor is open */
+	SVN_ERR (svn_ra_reparent (session, root, pool));
 
-	if (commit_info == NULL) {
-		lua_pushnil (L);
-	} else {
-		lua_pushinteger (L, commit_info->revision);
-	}
+	paths = apr_array_make (pool, apr_hash_count (txn->ops), sizeof (const char *));
 
-	svn_pool_destroy (pool);
-	return 1;
-}
+	for (hi = apr_hash_first (pool, txn->ops); hi; hi = apr_hash_next (hi)) {
+		const void *key;
+		void *val;
 
+		apr_hash_this (hi, &key, NULL, &val);
+		SVN_ERR (txn_check_op (session, root, svn_path_join (base, key, pool),
+							   val, eb.base_rev, pool));
+		APR_ARRAY_PUSH (paths, const char *) = key;
+	}
 
-static svn_error_t *
-list_func (void *baton,
-		   const char *path,
-		   const svn_dirent_t *dirent,
-		   const svn_lock_t *lock,
-		   const char *abs_path,
-		   apr_pool_t *pool)
-{
-	lua_State *L = baton;
+	SVN_ERR (svn_ra_reparent (session, txn->url, pool));
 
-	if (strcmp (path, "") == 0) {
-		if (dirent->kind == svn_node_file) {
-			path = svn_path_basename (abs_path, pool);
-		} else {
-			return SVN_NO_ERROR;
-		}
-	} 	
-	
-	lua_pushfstring (L, "%s%s", path, dirent->kind == svn_node_dir ? "/" : "");
-	
-	lua_newtable (L);
-	
-	if (dirent->kind == svn_node_file)
-		lua_pushinteger (L, dirent->size);
-	else
-		lua_pushnil (L);
+	revprops = apr_hash_make (pool);
+	apr_hash_set (revprops, SVN_PROP_REVISION_LOG, APR_HASH_KEY_STRING,
+				  svn_string_create (txn->message, pool));
 
-	lua_setfield (L, -2, "size");
+	*revision = SVN_INVALID_REVNUM;
+	eb.txn = txn;
 
-	if (dirent->last_author)
-		lua_pushstring (L, dirent->last_author);
-	else
-		lua_pushnil (L);
+	SVN_ERR (svn_ra_get_commit_editor3 (session, &eb.editor, &eb.edit_baton, revprops,
+										txn_commit_callback, revision, NULL, FALSE, pool));
 
-	lua_setfield (L, -2, "author");
-	
-	lua_pushinteger (L, dirent->created_rev);
-	lua_setfield (L, -2, "revision");
+	err = svn_delta_path_driver (eb.editor, eb.edit_baton, eb.base_rev, paths,
+								 txn_path_driver, &eb, pool);
+	if (!err) {
+		err = eb.editor->close_edit (eb.edit_baton, pool);
+	}
+	if (err) {
+		svn_error_clear (eb.editor->abort_edit (eb.edit_baton, pool));
+	}
+	return err;
+}
 
-	lua_pushstring (L, svn_time_to_human_cstring (dirent->time, pool));
-	lua_setfield (L, -2, "date");
 
-	lua_settable (L, -3);
+static int
+txn_gc (lua_State *L) {
+	txn_t *txn = luaL_checkudata (L, 1, LUASVN_TXN);
 
-	return SVN_NO_ERROR;
+	if (txn->pool != NULL) {
+		svn_pool_destroy (txn->pool);
+		txn->pool = NULL;
+	}
+	return 0;
 }
 
+
+/* Commits the changes in one revision and closes the transaction */
 static int
-l_list (lua_State *L) {
-	apr_pool_t *pool;
+txn_commit (lua_State *L) {
+	txn_t *txn = check_txn (L);
+	luasvn_client *client = txn->client;
+	ra_session_entry *entry;
+	svn_revnum_t revision;
 	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+	apr_pool_t *pool;
+	cancel_token_t *token;
+	apr_time_t deadline;
 
-	svn_opt_revision_t revision;
-	svn_opt_revision_t peg_revision;
+	if (client->pool == NULL) {
+		return send_error (L, "Client is closed\n");
+	}
 
-	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
-	int itable = 3;
-	svn_depth_t depth = svn_depth_immediates;
-	svn_boolean_t fetch_locks = FALSE;
-	peg_revision.kind = svn_opt_revision_unspecified;
+	getcancelfields (L, 2, client, &deadline, &token);
 
-	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		revision.kind = get_revision_kind (path);
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 2);
+	if (apr_hash_count (txn->ops) == 0) {
+		txn_gc (L);
+		lua_pushnil (L);
+		return 1;
 	}
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "fetch_locks", -1, &fetch_locks);
-	}
+	pool = svn_pool_create (txn->pool);
+	begin_call (client, deadline, token, pool);
 
-	init_function (&ctx, &pool, L);
-	path = svn_path_canonicalize (path, pool);
-	lua_newtable (L);
+	err = session_acquire (&entry, client, txn->url, pool);
+	IF_ERROR_RETURN (err, pool, L);
 
-	err = svn_client_list2 (path, &peg_revision, &revision, depth, SVN_DIRENT_ALL,
-			                fetch_locks, list_func, L, ctx, pool);
+	err = txn_drive (txn, entry->session, &revision, pool);
+	session_release (client, entry, err);
 	IF_ERROR_RETURN (err, pool, L);
 
-	svn_pool_destroy (pool);
+	txn_gc (L);
+
+	lua_pushinteger (L, revision);
 	return 1;
 }
 
 
-static svn_error_t *
-log_receiver (void *baton, svn_log_entry_t *le, apr_pool_t *pool)
-/*void *baton,
-			  apr_hash_t *changed_paths,
-			  svn_revnum_t revision,
-			  const char *author,
-			  const char *date,
-			  const char *message,
-			  apr_pool_t *pool) */
-{
-	const char *author, *date, *message;
-	lua_pushinteger ((lua_State*)baton, le->revision);
+static const struct luaL_Reg txn_methods [] = {
+	{"commit", txn_commit},
+	{"copy", txn_copy},
+	{"delete", txn_delete},
+	{"mkdir", txn_mkdir},
+	{"propset", txn_propset},
+	{"put", txn_put},
+	{NULL, NULL}
+};
 
-	svn_compat_log_revprops_out(&author, &date, &message, le->revprops);
 
-	lua_newtable ((lua_State*)baton);
+static int
+l_txn (lua_State *L) {
+	txn_t *txn;
+	svn_error_t *err;
+	apr_pool_t *pool;
+
+	const char *url = luaL_checkstring (L, 1);
+	const char *message = (lua_gettop (L) < 2 || lua_isnil (L, 2)) ? "" : luaL_checkstring (L, 2);
+	luasvn_client *client = get_client (L);
 
-	lua_pushstring ((lua_State*)baton, date);
-	lua_setfield ((lua_State*)baton, -2, "date");
+	if (!svn_path_is_url (url)) {
+		return send_error (L, "A transaction needs a URL\n");
+	}
 
-	lua_pushstring ((lua_State*)baton, message);
-	lua_setfield ((lua_State*)baton, -2, "message");
+	txn = lua_newuserdata (L, sizeof (txn_t));
+	memset (txn, 0, sizeof (txn_t));
+	luaL_getmetatable (L, LUASVN_TXN);
+	lua_setmetatable (L, -2);
 
-	lua_pushstring ((lua_State*)baton, author);
-	lua_setfield ((lua_State*)baton, -2, "author");
+	/* Keeps the client alive while the transaction is open */
+	lua_newtable (L);
+	if (lua_touserdata (L, lua_upvalueindex (1)) != NULL) {
+		lua_pushvalue (L, lua_upvalueindex (1));
+	} else {
+		lua_getfield (L, LUA_REGISTRYINDEX, LUASVN_DEFAULT_CLIENT);
+	}
+	lua_rawseti (L, -2, 1);
+	lua_setfenv (L, -2);
 
-	lua_settable ((lua_State*)baton, -3);
+	txn->pool = create_pool ();
+	if (txn->pool == NULL) {
+		return send_error (L, "Error creating allocator\n");
+	}
 
-	return SVN_NO_ERROR;
+	pool = svn_pool_create (txn->pool);
+
+	txn->client = client;
+	txn->url = svn_path_canonicalize (url, txn->pool);
+	txn->ops = apr_hash_make (txn->pool);
+
+	err = svn_utf_cstring_to_utf8 (&txn->message, message, txn->pool);
+	IF_ERROR_RETURN (err, pool, L);
+
+	svn_pool_destroy (pool);
+	return 1;
 }
 
 
 static int
-l_log (lua_State *L) {
+l_update (lua_State *L) {
 	apr_pool_t *pool;
 	svn_error_t *err;
 	svn_client_ctx_t *ctx;
 	
 	apr_array_header_t *array;
-	svn_opt_revision_t start, end;
-	svn_opt_revision_t peg_revision;
-	apr_array_header_t *revision_ranges;
-  	svn_opt_revision_range_t *range;
-
-  	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
-	int itable = 5;
-	int limit = 0; 
-	svn_boolean_t discover_changed_paths = FALSE;
-	svn_boolean_t strict_node_history = FALSE;
-	svn_boolean_t include_merged_revisions = FALSE;
-	peg_revision.kind = svn_opt_revision_unspecified;
-	start.kind = svn_opt_revision_number;
+	svn_opt_revision_t revision;
+	int i;
 	
+	int itable = 3;
+	svn_depth_t depth = svn_depth_infinity;
+	svn_boolean_t depth_is_sticky = FALSE;
+	svn_boolean_t ignore_externals = FALSE;
+	svn_boolean_t allow_unver_obstructions = FALSE;
+	apr_array_header_t *result_revs = NULL;
+
 	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		start.value.number = 0;
+		revision.kind = svn_opt_revision_head;
 	} else {
-		start.value.number = lua_tointeger (L, 2);
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
 	}
+	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
+		getdepthfield(L, itable, -1, &depth);
+		getboolfield(L, itable, "depth_is_sticky", -1, &depth_is_sticky);
+		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
+		getboolfield(L, itable, "allow_unver_obstructions", -1, &allow_unver_obstructions);
+	} 
 
-	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
-		end.kind = get_revision_kind (path);
+	if (!lua_isnoneornil (L, 1)) {
+		checkpaths (L, 1);
+	}
+
+	init_function (&ctx, &pool, L, itable);
+
+	if (lua_isnoneornil (L, 1)) {
+		array = apr_array_make (pool, 1, sizeof (const char *));
+		APR_ARRAY_PUSH (array, const char *) = "";
 	} else {
-		end.kind = svn_opt_revision_number;
-		end.value.number = lua_tointeger (L, 3);
+		array = getpatharray (L, 1, pool);
 	}
 
-	if (lua_gettop (L) >= 4) {
-		limit = lua_tointeger (L, 4);
+	err = svn_client_update3 (&result_revs, array, &revision, depth, depth_is_sticky,
+							  ignore_externals, allow_unver_obstructions, ctx, pool);
+	IF_ERROR_RETURN (err, pool, L);	
+
+	/* An array of paths gets the revision of each path, in order */
+	if (result_revs == NULL) {
+		lua_pushnil (L);
+	} else if (lua_istable (L, 1)) {
+		lua_createtable (L, result_revs->nelts, 0);
+		for (i = 0; i < result_revs->nelts; i++) {
+			lua_pushinteger (L, APR_ARRAY_IDX (result_revs, i, svn_revnum_t));
+			lua_rawseti (L, -2, i + 1);
+		}
+	} else {
+		lua_pushinteger (L, APR_ARRAY_IDX (result_revs, 0, svn_revnum_t));
 	}
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getboolfield(L, itable, "discover_changed_paths", -1, &discover_changed_paths);
-		getboolfield(L, itable, "strict_node_history", -1, &strict_node_history);
-		getboolfield(L, itable, "include_merged_revisions", -1, &include_merged_revisions);
-	} 
 
-	init_function (&ctx, &pool, L);
+	svn_pool_destroy (pool);
+	return 1;
+}
 
-	path = svn_path_canonicalize (path, pool);
 
-	array = apr_array_make (pool, 1, sizeof (const char *));
-	(*((const char **) apr_array_push (array))) = path;
+/* Sets the tunables of the client from the table at ITABLE */
+static void
+configure_client (lua_State *L, luasvn_client *client, int itable) {
+	int idle = (int) apr_time_sec (client->session_idle);
+	int cat_cache_size = (int) client->cat_cache.max_size;
+
+	getintfield(L, itable, "max_sessions", -1, &client->max_sessions);
+	getintfield(L, itable, "session_idle", -1, &idle);
+	getintfield(L, itable, "async_threads", -1, &client->async_threads);
+	getintfield(L, itable, "cat_cache_size", -1, &cat_cache_size);
+	getintfield(L, itable, "list_cache_size", -1, &client->list_cache.max_entries);
+
+	client->session_idle = apr_time_from_sec (idle);
+	client->cat_cache.max_size = cat_cache_size > 0 ? (apr_size_t) cat_cache_size : 0;
+	cat_cache_trim (client, client->cat_cache.max_size);
+	if (client->list_cache.entries != NULL) {
+		list_cache_trim (client, client->list_cache.max_entries);
+	}
 
-	range = apr_palloc(pool, sizeof(svn_opt_revision_range_t));
-	range->start = start;
-	range->end = end;
+	getboolfield(L, itable, "log_cache", -1, &client->log_cache.enabled);
 
-	revision_ranges = apr_array_make(pool, 1, sizeof(svn_opt_revision_range_t *));
+	/* false turns the disk cache off */
+	lua_getfield (L, itable, "cache_dir");
+	if (lua_isstring (L, -1)) {
+		client->cache_dir = svn_path_canonicalize (apr_pstrdup (client->pool, lua_tostring (L, -1)),
+												   client->pool);
+	} else if (lua_isboolean (L, -1) && !lua_toboolean (L, -1)) {
+		client->cache_dir = NULL;
+	}
+	lua_pop (L, 1);
 
-	APR_ARRAY_PUSH(revision_ranges, svn_opt_revision_range_t *) = range;
+	lua_getfield (L, itable, "timeout");
+	if (lua_isnumber (L, -1)) {
+		client->timeout = (apr_interval_time_t) (lua_tonumber (L, -1) * APR_USEC_PER_SEC);
+	}
+	lua_pop (L, 1);
+
+	/* Drops the sessions that are now over the limits */
+	session_expire (client, apr_time_now ());
+	while (client->nsessions > client->max_sessions) {
+		ra_session_entry *entry = client->sessions;
+		while (entry->next != NULL) {
+			entry = entry->next;
+		}
+		session_close (client, entry);
+		client->session_stats.evicted++;
+	}
+}
 
-	lua_newtable (L);
 
-	err = svn_client_log5 (array, &peg_revision, revision_ranges, limit, 
-					discover_changed_paths, strict_node_history, include_merged_revisions,
-					NULL, log_receiver, L, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+static int
+l_configure (lua_State *L) {
+	luasvn_client *client = get_client (L);
 
-	svn_pool_destroy (pool);
-	return 1;
+	luaL_checktype (L, 1, LUA_TTABLE);
+	configure_client (L, client, 1);
+	return 0;
 }
 
 
 static int
-l_merge (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+l_cache_stats (lua_State *L) {
+	luasvn_client *client = get_client (L);
 
-	svn_opt_revision_t rev1;
-	svn_opt_revision_t rev2;
+	lua_newtable (L);
 
-	const char *source1 = NULL;
-	const char *source2 = NULL;
-	const char *wcpath = NULL;
-	int itable = 6;
-	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t ignore_ancestry = FALSE;
-	svn_boolean_t force = FALSE;
-	svn_boolean_t record_only = FALSE;
-	svn_boolean_t dry_run = FALSE;
+	lua_newtable (L);
 
-	source1 = luaL_checkstring (L, 1);
-		
-	if (lua_isnil (L, 2)) {
-		rev1.kind = svn_opt_revision_head;
-	} else {
-		rev1.kind = svn_opt_revision_number;
-		rev1.value.number = lua_tointeger (L, 2);
-	}
+	lua_pushinteger (L, client->cat_cache.hits);
+	lua_setfield (L, -2, "hits");
 
-	source2 = luaL_checkstring (L, 3);
+	lua_pushinteger (L, client->cat_cache.misses);
+	lua_setfield (L, -2, "misses");
 
-	if (lua_isnil (L, 4)) {
-		rev2.kind = svn_opt_revision_head;
-	} else {
-		rev2.kind = svn_opt_revision_number;
-		rev2.value.number = lua_tointeger (L, 4);
-	}
+	lua_pushinteger (L, client->cat_cache.evicted);
+	lua_setfield (L, -2, "evicted");
 
-	if (lua_gettop (L) < 5 || lua_isnil (L, 5)) {
-		wcpath = "";
-	} else {
-		wcpath = luaL_checkstring (L, 5);
-	}
+	lua_pushinteger (L, client->cat_cache.entries != NULL ?
+					 apr_hash_count (client->cat_cache.entries) : 0);
+	lua_setfield (L, -2, "entries");
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "ignore_ancestry", -1, &ignore_ancestry);
-		getboolfield(L, itable, "force", -1, &force);
-		getboolfield(L, itable, "record_only", -1, &record_only);
-		getboolfield(L, itable, "dry_run", -1, &dry_run);
-	}
+	lua_pushinteger (L, client->cat_cache.size);
+	lua_setfield (L, -2, "size");
+
+	lua_setfield (L, -2, "cat");
+
+	lua_newtable (L);
 
-	init_function (&ctx, &pool, L);
+	lua_pushinteger (L, client->list_cache.hits);
+	lua_setfield (L, -2, "hits");
 
-	source1 = svn_path_canonicalize (source1, pool);
-	source2 = svn_path_canonicalize (source2, pool);
-	wcpath = svn_path_canonicalize (wcpath, pool);
+	lua_pushinteger (L, client->list_cache.misses);
+	lua_setfield (L, -2, "misses");
 
-	err = svn_client_merge3 (source1, &rev1, source2, &rev2, wcpath, depth,
-					ignore_ancestry, force, record_only, dry_run, NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);	
+	lua_pushinteger (L, client->list_cache.evicted);
+	lua_setfield (L, -2, "evicted");
 
-	svn_pool_destroy (pool);
-	return 0;
-}
+	lua_pushinteger (L, client->list_cache.entries != NULL ?
+					 apr_hash_count (client->list_cache.entries) : 0);
+	lua_setfield (L, -2, "entries");
 
+	lua_setfield (L, -2, "list");
 
-static int
-l_mkdir (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-	
-	apr_array_header_t *array;
-	
-	const char *path = luaL_checkstring (L, 1);
-	const char *message = (lua_gettop (L) < 2 || lua_isnil (L, 2)) ? "" : luaL_checkstring (L, 2);
-	svn_commit_info_t *commit_info = NULL;
-	int itable = 3;
-	svn_boolean_t make_parents = FALSE;
+	lua_newtable (L);
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getboolfield(L, itable, "make_parents", -1, &make_parents);
-	}
+	lua_pushinteger (L, client->disk_cache.hits);
+	lua_setfield (L, -2, "hits");
 
-	init_function (&ctx, &pool, L);
+	lua_pushinteger (L, client->disk_cache.misses);
+	lua_setfield (L, -2, "misses");
 
-	path = svn_path_canonicalize (path, pool);
+	lua_pushinteger (L, client->disk_cache.stores);
+	lua_setfield (L, -2, "stores");
 
-	array = apr_array_make (pool, 1, sizeof (const char *));
-	APR_ARRAY_PUSH(array, const char *) = path;
+	lua_setfield (L, -2, "disk");
 
-	if (svn_path_is_url (path)) {
-		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
-		ctx->log_msg_func2 = log_msg_func2;
-	}
+	lua_newtable (L);
 
-	err = svn_client_mkdir3 (&commit_info, array, make_parents, NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	lua_pushinteger (L, client->log_cache.hits);
+	lua_setfield (L, -2, "hits");
 
-	if (commit_info == NULL) {
-		lua_pushnil (L);
-	} else {
-		lua_pushinteger (L, commit_info->revision);
-	}
+	lua_pushinteger (L, client->log_cache.syncs);
+	lua_setfield (L, -2, "syncs");
+
+	lua_setfield (L, -2, "log");
 
-	svn_pool_destroy (pool);
 	return 1;
 }
 
 
 static int
-l_move (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-
-	apr_array_header_t *arraypath;
+l_session_stats (lua_State *L) {
+	luasvn_client *client = get_client (L);
 
-	const char *src_path = luaL_checkstring (L, 1);
-	const char *dest_path = luaL_checkstring (L, 2);
-	const char *message = (lua_gettop (L) < 3 || lua_isnil (L, 3)) ? "" : luaL_checkstring (L, 3);
-	int itable = 4;
-	svn_boolean_t force = FALSE;
-	svn_boolean_t move_as_child = FALSE;
-	svn_boolean_t make_parents = FALSE;
-	svn_commit_info_t *commit_info = NULL;
-	
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getboolfield(L, itable, "force", -1, &force);
-		getboolfield(L, itable, "move_as_child", -1, &move_as_child);
-		getboolfield(L, itable, "make_parents", -1, &make_parents);
-	} 
+	lua_newtable (L);
 
-	init_function (&ctx, &pool, L);
+	lua_pushinteger (L, client->session_stats.hits);
+	lua_setfield (L, -2, "hits");
 
-	src_path = svn_path_canonicalize (src_path, pool);
-	dest_path = svn_path_canonicalize (dest_path, pool);
-	
-	if (svn_path_is_url (dest_path)) {
-		make_log_msg_baton (&(ctx->log_msg_baton2), message, NULL, ctx->config, pool, L);
-		ctx->log_msg_func2 = log_msg_func2;
-	}
+	lua_pushinteger (L, client->session_stats.misses);
+	lua_setfield (L, -2, "misses");
 
-	arraypath = apr_array_make(pool, 1, sizeof(const char *));
-	APR_ARRAY_PUSH(arraypath, const char *) = src_path;
+	lua_pushinteger (L, client->session_stats.expired);
+	lua_setfield (L, -2, "expired");
 
-	err = svn_client_move5 (&commit_info, arraypath, dest_path, force,
-		   					move_as_child, make_parents, NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);	
+	lua_pushinteger (L, client->session_stats.evicted);
+	lua_setfield (L, -2, "evicted");
 
-	if (commit_info == NULL) {
-		lua_pushnil (L);
-	} else {
-		lua_pushinteger (L, commit_info->revision);
-	}
+	lua_pushinteger (L, client->nsessions);
+	lua_setfield (L, -2, "open");
 
-	svn_pool_destroy (pool);
 	return 1;
 }
 
 
-static int
-l_propget (lua_State *L) {
+typedef struct job_t job_t;
+
+/* The worker threads running the asynchronous operations of a client.
+   It is freed once the client is closed and its jobs are collected. */
+typedef struct async_pool_t {
 	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;    /* signals new jobs and finished ones */
+	apr_thread_t **threads;
+	apr_pool_t **thread_pools;
+	int nthreads;
+
+	luasvn_client_opts opts;
+	int max_sessions;
+	apr_interval_time_t session_idle;
+	const char *cache_dir;
+	svn_boolean_t log_cache;
+	apr_size_t cat_cache_size;  /* of each worker, which has its own caches */
+	int list_cache_size;
+
+	job_t *head;                /* jobs waiting for a worker */
+	job_t *tail;
+	job_t *finished;            /* finished jobs not yet given by completed */
+	apr_file_t *notify_read;    /* readable once a job has finished */
+	apr_file_t *notify_write;
+	int refs;                   /* held by the client and by each job */
+	svn_boolean_t shutdown;
+} async_pool_t;
+
+enum job_state {
+	job_queued,
+	job_running,
+	job_finished
+};
 
-	apr_hash_t *props;
-	const char *propname_utf8;
-	const void *key;
-	void *val;
-	apr_hash_index_t *hi;
-	svn_opt_revision_t peg_revision;
-	svn_opt_revision_t revision;
+/* An operation run by a worker thread. Its results stay in its pool
+   until they are read by the handle. */
+struct job_t {
+	apr_pool_t *pool;
+	async_pool_t *async;
+	job_t *next;
+	enum job_state state;
+	svn_boolean_t abandoned;    /* the handle was collected while running */
+	cancel_token_t token;       /* set by cancel */
+	apr_time_t deadline;        /* or 0 */
 
-	const char *path = luaL_checkstring (L, 1);
-	const char *propname = luaL_checkstring (L, 2);
-	int itable = 4;
-	svn_depth_t depth = svn_depth_empty;
-	peg_revision.kind = svn_opt_revision_unspecified;
+	svn_error_t *(*run) (job_t *job, luasvn_client *client, apr_pool_t *pool);
+	int (*push) (lua_State *L, job_t *job);
+	void *baton;
 
-	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
-		revision.kind = svn_opt_revision_unspecified;
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 3);
-	}
+	svn_error_t *err;
+	const char *message;        /* message of the error, once raised */
+};
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-	} 
+#define LUASVN_JOB "luasvn.job"
+#define LUASVN_JOBS "luasvn.jobs"
 
-	init_function (&ctx, &pool, L);
 
-	path = svn_path_canonicalize (path, pool);
-	
-	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
-	IF_ERROR_RETURN (err, pool, L);
+/* Moves JOB, finished, to the list read by completed and wakes up the
+   event loop watching the descriptor. Called with the mutex locked. */
+static void
+job_finish (job_t *job, svn_error_t *err) {
+	async_pool_t *async = job->async;
+	apr_size_t len = 1;
 
-	err = svn_client_propget3 (&props, propname_utf8, path, &peg_revision, &revision,
-							   NULL, depth, NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	job->err = err;
+	job->state = job_finished;
+	job->next = async->finished;
+	async->finished = job;
 
-	lua_newtable (L);
+	/* The pipe does not block; when it is full it is readable already */
+	apr_file_write (async->notify_write, "", &len);
+}
 
-	for (hi = apr_hash_first (pool, props); hi; hi = apr_hash_next (hi)) {
-	  svn_string_t *s;
-	  apr_hash_this (hi, &key, NULL, &val);
-	  s = (svn_string_t *) val;
-	  
-	  lua_pushstring (L, s->data);
-	  lua_setfield (L, -2, (char *) key);
+
+/* Removes JOB from the list at HEAD, if it is there. TAIL, if not NULL,
+   points to the last job of the list. Called with the mutex locked. */
+static void
+job_unlink (job_t **head, job_t **tail, job_t *job) {
+	job_t *p, *prev;
+
+	for (prev = NULL, p = *head; p != NULL; prev = p, p = p->next) {
+		if (p == job) {
+			if (prev != NULL) {
+				prev->next = job->next;
+			} else {
+				*head = job->next;
+			}
+			if (tail != NULL && *tail == job) {
+				*tail = prev;
+			}
+			return;
+		}
 	}
+}
 
-	svn_pool_destroy (pool);
-	return 1;
+
+/* Frees JOB, with the mutex of its pool locked. Returns TRUE when it
+   held the last reference to the pool. */
+static svn_boolean_t
+job_free (job_t *job) {
+	async_pool_t *async = job->async;
+
+	svn_error_clear (job->err);
+	svn_pool_destroy (job->pool);
+	return --async->refs == 0;
 }
 
+
+/* Cancel function of a worker client, whose async field points to the
+   pool it works for. Stops the running job when the pool shuts down,
+   and else as client_cancel does with the token and deadline of the
+   job. */
 static svn_error_t *
-proplist_receiver (void *baton, const char *path, apr_hash_t *prop_hash, apr_pool_t *pool)
-{
-	apr_hash_index_t *hi;
-	const char *name_local;
-	svn_error_t *err;
-	int is_url = svn_path_is_url (path);
-	lua_State *L = (lua_State *)baton;
-	lua_newtable (L);
+async_cancel (void *baton) {
+	luasvn_client *client = baton;
+	async_pool_t *async = client->async;
+	svn_boolean_t shutdown;
 
-	if (is_url) {
-		name_local = svn_path_local_style (path, pool);
-	} else {
-		name_local = path;
-	}
+	apr_thread_mutex_lock (async->mutex);
+	shutdown = async->shutdown;
+	apr_thread_mutex_unlock (async->mutex);
 
-	lua_pushstring (L, name_local);
+	if (shutdown) {
+		return svn_error_create (SVN_ERR_CANCELLED, NULL, NULL);
+	}
+	return client_cancel (client);
+}
 
-	for (hi = apr_hash_first(pool, prop_hash); hi; hi = apr_hash_next (hi)) {
-		const void *key;
-		void *val;
-		const char *pname;
-		svn_string_t *pval;
 
-		apr_hash_this (hi, &key, NULL, &val);
+/* Runs the queued jobs. Each worker has a client of its own, with its
+   own context and session cache, built with the options of the client
+   that started it. */
+static void * APR_THREAD_FUNC
+async_worker (apr_thread_t *thread, void *data) {
+	async_pool_t *async = data;
+	luasvn_client client;
+	apr_pool_t *iterpool = NULL;
+	svn_error_t *init_err;
+	job_t *job;
+
+	memset (&client, 0, sizeof (luasvn_client));
+	client.opts = async->opts;
+	client.max_sessions = async->max_sessions;
+	client.session_idle = async->session_idle;
+	client.cache_dir = async->cache_dir;
+	client.log_cache.enabled = async->log_cache;
+	client.cat_cache.max_size = async->cat_cache_size;
+	client.list_cache.max_entries = async->list_cache_size;
+	client.async = async;
+	client.pool = create_pool ();
+
+	if (client.pool == NULL) {
+		init_err = svn_error_create (APR_ENOMEM, NULL, "Error creating allocator");
+	} else {
+		init_err = create_context (&client.ctx, &client.opts, client.pool);
+		if (!init_err) {
+			client.ctx->cancel_func = async_cancel;
+			client.ctx->cancel_baton = &client;
+		}
+		iterpool = svn_pool_create (client.pool);
+	}
 
-		pname = key;
-		pval = (svn_string_t *) val;
+	apr_thread_mutex_lock (async->mutex);
 
-		err = svn_cmdline_cstring_from_utf8 (&pname, pname, pool);
-		IF_ERROR_RETURN (err, pool, L);
+	for (;;) {
+		svn_error_t *err;
 
-		lua_pushstring (L, pval->data);
-		lua_setfield (L, -1, pname);
-	}
+		while (async->head == NULL && !async->shutdown) {
+			apr_thread_cond_wait (async->cond, async->mutex);
+		}
 
-	return SVN_NO_ERROR;
-}
+		if (async->shutdown) {
+			break;
+		}
 
-static int
-l_proplist (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+		job = async->head;
+		async->head = job->next;
+		if (async->head == NULL) {
+			async->tail = NULL;
+		}
+		job->state = job_running;
 
-	svn_opt_revision_t peg_revision;
-	svn_opt_revision_t revision;
+		apr_thread_mutex_unlock (async->mutex);
 
-	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
-	int itable = 3;
-	svn_depth_t depth = svn_depth_empty;
-	peg_revision.kind = svn_opt_revision_unspecified;
+		if (init_err) {
+			err = svn_error_dup (init_err);
+		} else {
+			svn_pool_clear (iterpool);
+			client.deadline = job->deadline;
+			client.cancel_token = &job->token;
+			err = job->run (job, &client, iterpool);
+		}
 
-	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		revision.kind = svn_opt_revision_unspecified;
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 2);
-	}	
+		apr_thread_mutex_lock (async->mutex);
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
+		if (job->abandoned) {
+			svn_error_clear (err);
+			job_free (job);
+		} else {
+			job_finish (job, err);
+		}
+		apr_thread_cond_broadcast (async->cond);
 	}
 
-	init_function (&ctx, &pool, L);
-
-	path = svn_path_canonicalize (path, pool);
+	apr_thread_mutex_unlock (async->mutex);
 
-	err = svn_client_proplist3 (path, &peg_revision, &revision, depth,
-							 	NULL, proplist_receiver, L, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	svn_error_clear (init_err);
+	if (client.pool != NULL) {
+		cat_cache_trim (&client, 0);
+		svn_pool_destroy (client.pool);
+	}
 
-	svn_pool_destroy (pool);
-	return 1;
+	apr_thread_exit (thread, APR_SUCCESS);
+	return NULL;
 }
 
-static int
-l_propset (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
 
-	const char *path = luaL_checkstring (L, 1);
-	const char *propname = luaL_checkstring (L, 2);
-	const char *propval = lua_isnil (L, 3) ? NULL : luaL_checkstring (L, 3);
-	const char *propname_utf8 = NULL;
-	int itable = 4;
-	svn_depth_t depth = svn_depth_empty;
-	svn_boolean_t skip_checks = FALSE;
+/* Stops the worker threads of CLIENT. Queued jobs fail, and running
+   ones are cancelled. */
+static void
+async_shutdown (luasvn_client *client) {
+	async_pool_t *async = client->async;
+	apr_status_t status;
+	svn_boolean_t last;
+	job_t *job;
+	int i;
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "skip_checks", -1, &skip_checks);
-	} 
+	if (async == NULL) {
+		return;
+	}
+	client->async = NULL;
 
-	init_function (&ctx, &pool, L);
+	apr_thread_mutex_lock (async->mutex);
 
-	path = svn_path_canonicalize (path, pool);
+	async->shutdown = TRUE;
+	while ((job = async->head) != NULL) {
+		async->head = job->next;
+		job_finish (job, svn_error_create (SVN_ERR_CANCELLED, NULL, "Client is closed"));
+	}
+	async->tail = NULL;
 
-	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	apr_thread_cond_broadcast (async->cond);
+	apr_thread_mutex_unlock (async->mutex);
 
-	if (propval != NULL) {
-		svn_string_t *sstring = svn_string_create (propval, pool);
-		err = svn_client_propset3 (NULL, propname_utf8, sstring, path, depth, skip_checks,
-								   SVN_INVALID_REVNUM, NULL, NULL, ctx, pool);
-	} else {
-		err = svn_client_propset3 (NULL, propname_utf8, NULL, path, depth, skip_checks,
-								   SVN_INVALID_REVNUM, NULL, NULL, ctx, pool);
+	for (i = 0; i < async->nthreads; i++) {
+		if (async->threads[i] != NULL) {
+			apr_thread_join (&status, async->threads[i]);
+			svn_pool_destroy (async->thread_pools[i]);
+		}
+	}
+
+	apr_thread_mutex_lock (async->mutex);
+	last = --async->refs == 0;
+	apr_thread_mutex_unlock (async->mutex);
+
+	if (last) {
+		svn_pool_destroy (async->pool);
 	}
-	IF_ERROR_RETURN (err, pool, L);
-	
-	svn_pool_destroy (pool);
-	return 0;
 }
 
 
-static int
-l_repos_create (lua_State *L) {
+/* Gets the worker threads of CLIENT, starting them on first use */
+static async_pool_t *
+get_async (lua_State *L, luasvn_client *client) {
+	async_pool_t *async = client->async;
 	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_repos_t *repos_p;
-	
-	const char *path = luaL_checkstring (L, 1);
+	int i;
 
-	if (init_pool (&pool) != 0) {
-		return init_pool_error (L);
+	if (async != NULL) {
+		return async;
+	}
+
+	pool = create_pool ();
+	if (pool == NULL) {
+		send_error (L, "Error creating allocator\n");
+	}
+
+	async = apr_pcalloc (pool, sizeof (async_pool_t));
+	async->pool = pool;
+
+	if (apr_thread_mutex_create (&async->mutex, APR_THREAD_MUTEX_DEFAULT, pool)
+			|| apr_thread_cond_create (&async->cond, pool)
+			|| apr_file_pipe_create (&async->notify_read, &async->notify_write, pool)
+			|| apr_file_pipe_timeout_set (async->notify_read, 0)
+			|| apr_file_pipe_timeout_set (async->notify_write, 0)) {
+		svn_pool_destroy (pool);
+		send_error (L, "Error creating the worker threads\n");
+	}
+
+	async->opts.config_dir = apr_pstrdup (pool, client->opts.config_dir);
+	async->opts.username = apr_pstrdup (pool, client->opts.username);
+	async->opts.password = apr_pstrdup (pool, client->opts.password);
+	async->opts.no_auth_cache = client->opts.no_auth_cache;
+	async->opts.trust_server_cert = client->opts.trust_server_cert;
+	/* A worker thread must never prompt */
+	async->opts.non_interactive = TRUE;
+
+	async->max_sessions = client->max_sessions;
+	async->session_idle = client->session_idle;
+	async->cache_dir = apr_pstrdup (pool, client->cache_dir);
+	async->log_cache = client->log_cache.enabled;
+	async->cat_cache_size = client->cat_cache.max_size;
+	async->list_cache_size = client->list_cache.max_entries;
+	async->refs = 1;
+
+	async->nthreads = client->async_threads > 0 ? client->async_threads : 1;
+	async->threads = apr_pcalloc (pool, async->nthreads * sizeof (apr_thread_t *));
+	async->thread_pools = apr_pcalloc (pool, async->nthreads * sizeof (apr_pool_t *));
+
+	client->async = async;
+
+	/* Every thread gets a root pool, as they exit at the same time */
+	for (i = 0; i < async->nthreads; i++) {
+		async->thread_pools[i] = create_pool ();
+		if (async->thread_pools[i] == NULL
+				|| apr_thread_create (&async->threads[i], NULL, async_worker,
+									  async, async->thread_pools[i])) {
+			if (async->thread_pools[i] != NULL) {
+				svn_pool_destroy (async->thread_pools[i]);
+			}
+			async->threads[i] = NULL;
+			async_shutdown (client);
+			send_error (L, "Error creating the worker threads\n");
+		}
 	}
 
-	path = svn_path_canonicalize (path, pool);
-
-	err = svn_repos_create (&repos_p, path, NULL, NULL, NULL, NULL, pool);
-	IF_ERROR_RETURN (err, pool, L);
-	return 0;
+	return async;
 }
 
 
-static int
-l_repos_delete (lua_State *L) {
+/* Pushes the handle of a new job of CLIENT that will run RUN. The job
+   is started by submit_job once its baton is set. Its deadline counts
+   from now with the timeout of the options at ITABLE; jobs are
+   cancelled with their cancel method rather than with a token. */
+static job_t *
+new_job (lua_State *L, luasvn_client *client, int itable,
+		 svn_error_t *(*run) (job_t *, luasvn_client *, apr_pool_t *),
+		 int (*push) (lua_State *, job_t *)) {
+	async_pool_t *async = get_async (L, client);
+	cancel_token_t *token;
+	apr_time_t deadline;
+	job_t **handle;
 	apr_pool_t *pool;
-	svn_error_t *err;
-	
-	const char *path = luaL_checkstring (L, 1);
+	job_t *job;
 
-	if (init_pool (&pool) != 0) {
-		return init_pool_error (L);
+	getcancelfields (L, itable, client, &deadline, &token);
+	if (token != NULL) {
+		send_error (L, "Jobs are cancelled with their cancel method\n");
 	}
-	
-	path = svn_path_canonicalize (path, pool);
 
-	err = svn_repos_delete (path, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	handle = lua_newuserdata (L, sizeof (job_t *));
 
-	return 0;
+	*handle = NULL;
+	luaL_getmetatable (L, LUASVN_JOB);
+	lua_setmetatable (L, -2);
+
+	pool = create_pool ();
+	if (pool == NULL) {
+		send_error (L, "Error creating allocator\n");
+	}
+
+	job = apr_pcalloc (pool, sizeof (job_t));
+	job->pool = pool;
+	job->async = async;
+	job->state = job_queued;
+	job->run = run;
+	job->push = push;
+	job->deadline = deadline;
+	apr_atomic_set32 (&job->token.cancelled, 0);
+
+	apr_thread_mutex_lock (async->mutex);
+	async->refs++;
+	apr_thread_mutex_unlock (async->mutex);
+
+	*handle = job;
+
+	/* Lets completed find the handle of the job */
+	lua_getfield (L, LUA_REGISTRYINDEX, LUASVN_JOBS);
+	lua_pushlightuserdata (L, job);
+	lua_pushvalue (L, -3);
+	lua_rawset (L, -3);
+	lua_pop (L, 1);
+
+	return job;
 }
 
 
+/* Queues JOB, whose handle is on the top of the stack */
 static int
-l_revprop_get (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+submit_job (lua_State *L, job_t *job) {
+	async_pool_t *async = job->async;
 
-	svn_opt_revision_t revision;
-	svn_string_t *propval;
-	svn_revnum_t rev;
-	svn_string_t *printable_val;
+	apr_thread_mutex_lock (async->mutex);
 
-	const char *url = luaL_checkstring (L, 1);
-	const char *propname = luaL_checkstring (L, 2);
-	const char *propname_utf8 = NULL;
-		
-	if (lua_gettop (L) < 3 || lua_isnil (L, 3)) {
-		revision.kind = get_revision_kind (url);
+	if (async->shutdown) {
+		job_finish (job, svn_error_create (SVN_ERR_CANCELLED, NULL, "Client is closed"));
 	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 3);
+		job->next = NULL;
+		if (async->tail != NULL) {
+			async->tail->next = job;
+		} else {
+			async->head = job;
+		}
+		async->tail = job;
+		apr_thread_cond_broadcast (async->cond);
 	}
 
-	init_function (&ctx, &pool, L);
-
-	url = svn_path_canonicalize (url, pool);
+	apr_thread_mutex_unlock (async->mutex);
+	return 1;
+}
 
-	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
-	IF_ERROR_RETURN (err, pool, L);
 
-	err = svn_client_revprop_get (propname_utf8, &propval, url, &revision, &rev, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+static job_t *
+check_job (lua_State *L) {
+	job_t **handle = luaL_checkudata (L, 1, LUASVN_JOB);
 
-	printable_val = propval;
-	if (svn_prop_needs_translation (propname_utf8)) {
-		err = svn_subst_detranslate_string (&printable_val, propval, TRUE, pool);
-		IF_ERROR_RETURN (err, pool, L);
+	if (*handle == NULL) {
+		send_error (L, "Job is closed\n");
 	}
-
-	lua_pushstring (L, printable_val->data);
-	svn_pool_destroy (pool);
-	return 1;
+	return *handle;
 }
 
 
 static int
-l_revprop_list (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+job_gc (lua_State *L) {
+	job_t **handle = luaL_checkudata (L, 1, LUASVN_JOB);
+	job_t *job = *handle;
+	async_pool_t *async;
+	svn_boolean_t last = FALSE;
+
+	if (job == NULL) {
+		return 0;
+	}
+	*handle = NULL;
+	async = job->async;
 
-	apr_hash_t *entries;
-	apr_hash_index_t *hi;
-	void *val;
-	const void *key;
-	svn_revnum_t rev;
-	svn_opt_revision_t revision;
-	
-	const char *url = luaL_checkstring (L, 1);
+	apr_thread_mutex_lock (async->mutex);
 
-	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		revision.kind = get_revision_kind (url);
+	if (job->state == job_running) {
+		/* The worker frees it when it is done, which nobody waits for */
+		job->abandoned = TRUE;
+		apr_atomic_set32 (&job->token.cancelled, 1);
 	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 2);
+		job_unlink (&async->head, &async->tail, job);
+		job_unlink (&async->finished, NULL, job);
+		last = job_free (job);
 	}
 
-	init_function (&ctx, &pool, L);
+	apr_thread_mutex_unlock (async->mutex);
 
-	url = svn_path_canonicalize (url, pool);
-	err = svn_client_revprop_list (&entries, url, &revision, &rev, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	if (last) {
+		svn_pool_destroy (async->pool);
+	}
+	return 0;
+}
 
-	lua_newtable (L);
 
-	for (hi = apr_hash_first (pool, entries); hi; hi = apr_hash_next (hi)) {
-		const char *pname;
-		svn_string_t *pval;
+/* Tells whether the job is finished, without waiting */
+static int
+job_done (lua_State *L) {
+	job_t *job = check_job (L);
+	svn_boolean_t done;
 
-		apr_hash_this (hi, &key, NULL, &val);
-	
-		pname = key;
+	apr_thread_mutex_lock (job->async->mutex);
+	done = job->state == job_finished;
+	apr_thread_mutex_unlock (job->async->mutex);
 
-		pval = (svn_string_t *) val;
-		if (svn_prop_needs_translation (pname)) {
-			err = svn_subst_translate_string (&pval, pval, APR_LOCALE_CHARSET, pool);
-			IF_ERROR_RETURN (err, pool, L);
-		}
+	lua_pushboolean (L, done);
+	return 1;
+}
 
-		err = svn_cmdline_cstring_from_utf8 (&pname, pname, pool);
-		IF_ERROR_RETURN (err, pool, L);
 
-		lua_pushstring (L, pval->data);
-		lua_setfield (L, -2, pname);
-	}
+/* Cancels the job. A queued job finishes at once, a running one at the
+   next check of its worker; both fail with "Operation cancelled". */
+static int
+job_cancel (lua_State *L) {
+	job_t *job = check_job (L);
+	async_pool_t *async = job->async;
 
-	svn_pool_destroy (pool);
-	return 1;
+	apr_atomic_set32 (&job->token.cancelled, 1);
+
+	apr_thread_mutex_lock (async->mutex);
+	if (job->state == job_queued) {
+		job_unlink (&async->head, &async->tail, job);
+		job_finish (job, svn_error_create (SVN_ERR_CANCELLED, NULL, "Operation cancelled"));
+		apr_thread_cond_broadcast (async->cond);
+	}
+	apr_thread_mutex_unlock (async->mutex);
+	return 0;
 }
 
 
+/* Waits for the job and returns its results, or raises its error */
 static int
-l_revprop_set (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
+job_wait (lua_State *L) {
+	job_t *job = check_job (L);
+	async_pool_t *async = job->async;
 
-	svn_opt_revision_t revision;
-   	svn_revnum_t rev;	
-	
-	const char *url = luaL_checkstring (L, 1);
-	const char *propname = luaL_checkstring (L, 2);
-	const char *propval = lua_isnil (L, 3) ? NULL : luaL_checkstring (L, 3);
-	const char *propname_utf8 = NULL;
-	int itable = 5;
-	svn_boolean_t force = FALSE;
+	apr_thread_mutex_lock (async->mutex);
+	while (job->state != job_finished) {
+		apr_thread_cond_wait (async->cond, async->mutex);
+	}
+	apr_thread_mutex_unlock (async->mutex);
 
-	if (lua_gettop (L) < 4 || lua_isnil (L, 4)) {
-		revision.kind = get_revision_kind (url);
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 4);
+	if (job->err != NULL) {
+		char buffer[1024];
+		svn_string_t *sstring;
+
+		sstring = svn_string_create (svn_err_best_message (job->err, buffer, sizeof (buffer)),
+									 job->pool);
+		svn_subst_detranslate_string (&sstring, sstring, TRUE, job->pool);
+		job->message = sstring->data;
+
+		svn_error_clear (job->err);
+		job->err = NULL;
 	}
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getboolfield(L, itable, "force", -1, &force);
-	} 
+	if (job->message != NULL) {
+		return send_error (L, job->message);
+	}
+	return job->push (L, job);
+}
 
-	init_function (&ctx, &pool, L);
 
-	url = svn_path_canonicalize (url, pool);
+typedef struct cat_job_bt {
+	const char *path;
+	svn_opt_revision_t revision;
+	svn_stringbuf_t *buffer;
+} cat_job_bt;
 
-	err = svn_utf_cstring_to_utf8 (&propname_utf8, propname, pool);
-	IF_ERROR_RETURN (err, pool, L);
 
-	if (propval != NULL) {
-		svn_string_t *sstring = svn_string_create (propval, pool);
+static svn_error_t *
+cat_job_run (job_t *job, luasvn_client *client, apr_pool_t *pool) {
+	cat_job_bt *bt = job->baton;
+	svn_stream_t *stream = svn_stream_empty (pool);
 
-		if (svn_prop_needs_translation (propname_utf8)) {
-			err = svn_subst_translate_string (&sstring, sstring, APR_LOCALE_CHARSET, pool);
-			IF_ERROR_RETURN (err, pool, L);
-		}
-	
-		err = svn_client_revprop_set2 (propname_utf8, sstring, NULL, url, &revision, &rev, force, ctx, pool);
-	} else {
-		err = svn_client_revprop_set2 (propname_utf8, NULL, NULL, url, &revision, &rev, force, ctx, pool);
-	}
-	IF_ERROR_RETURN (err, pool, L);
-	
-	svn_pool_destroy (pool);
-	return 0;
+	svn_stream_set_write (stream, write_fn);
+	svn_stream_set_baton (stream, bt->buffer);
+
+	return cat_path (client, bt->path, &bt->revision, stream, bt->buffer, pool);
 }
 
 
-typedef struct status_bt {
-	lua_State *L;
-	svn_boolean_t detailed;
-	svn_boolean_t show_last_committed;
-	svn_boolean_t repos_locks;
-} status_bt;
+static int
+cat_job_push (lua_State *L, job_t *job) {
+	cat_job_bt *bt = job->baton;
+
+	lua_pushlstring (L, bt->buffer->data, bt->buffer->len);
+	return 1;
+}
 
 
-/* ====================================================================
- * Copyright (c) 2000-2004 CollabNet.  All rights reserved.
- * 
- * The code of "generate_status_code" is from status.c
- * "print_status" is based on the code of the function with the
- * same name in status.c
- */
+static int
+l_async_cat (lua_State *L) {
+	job_t *job;
+	cat_job_bt *bt;
+	svn_opt_revision_t revision;
 
+	const char *path = luaL_checkstring (L, 1);
+	luasvn_client *client = get_client (L);
 
-/* Return the single character representation of STATUS */
-static char
-generate_status_code(enum svn_wc_status_kind status)
-{
-  	switch (status)
-  	{
-	  	case svn_wc_status_none:        return ' ';
-		case svn_wc_status_normal:      return ' ';
-		case svn_wc_status_added:       return 'A';
-		case svn_wc_status_missing:     return '!';
-		case svn_wc_status_incomplete:  return '!';
-		case svn_wc_status_deleted:     return 'D';
-		case svn_wc_status_replaced:    return 'R';
-		case svn_wc_status_modified:    return 'M';
-		case svn_wc_status_merged:      return 'G';
-		case svn_wc_status_conflicted:  return 'C';
-		case svn_wc_status_obstructed:  return '~';
-		case svn_wc_status_ignored:     return 'I';
-		case svn_wc_status_external:    return 'X';
-		case svn_wc_status_unversioned: return '?';
-		default:                        return '?';
+	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
+		revision.kind = get_revision_kind (path);
+	} else {
+		revision.kind = svn_opt_revision_number;
+		revision.value.number = lua_tointeger (L, 2);
 	}
+
+	job = new_job (L, client, 3, cat_job_run, cat_job_push);
+
+	bt = apr_palloc (job->pool, sizeof (cat_job_bt));
+	bt->path = svn_path_canonicalize (path, job->pool);
+	bt->revision = revision;
+	bt->buffer = svn_stringbuf_create ("", job->pool);
+	job->baton = bt;
+
+	return submit_job (L, job);
 }
 
 
-/* Print STATUS and PATH in a format determined by DETAILED and
-   SHOW_LAST_COMMITTED. */
-static svn_error_t *
-print_status(const char *path,
-             svn_boolean_t detailed,
-             svn_boolean_t show_last_committed,
-             svn_boolean_t repos_locks,
-             svn_wc_status2_t *status,
-             lua_State *L,
-			 apr_pool_t *pool)
-{	
-	const char *info;
-	
-	if (detailed)
-	{
-		char ood_status, lock_status;
-		const char *working_rev;
+typedef struct list_job_bt {
+	list_args args;
+	apr_array_header_t *names;
+	apr_array_header_t *dirents;
+} list_job_bt;
 
-		if (! status->entry)
-			working_rev = "";
-		else if (! SVN_IS_VALID_REVNUM(status->entry->revision))
-			working_rev = " ? ";
-		else if (status->copied)
-			working_rev = "-";
-		else
-			working_rev = apr_psprintf(pool, "%ld", status->entry->revision);
 
-		if (status->repos_text_status != svn_wc_status_none
-				|| status->repos_prop_status != svn_wc_status_none)
-			ood_status = '*';
-		else
-			ood_status = ' ';
+static svn_error_t *
+list_job_func (void *baton,
+			   const char *path,
+			   const svn_dirent_t *dirent,
+			   const svn_lock_t *lock,
+			   const char *abs_path,
+			   apr_pool_t *pool)
+{
+	job_t *job = baton;
+	list_job_bt *bt = job->baton;
+	const char *name = list_entry_name (path, dirent, abs_path, job->pool);
 
-		if (repos_locks)
-		{
-		   	if (status->repos_lock)
-		   	{
-			 	if (status->entry && status->entry->lock_token)
-			 	{
-			   		if (strcmp(status->repos_lock->token, status->entry->lock_token)
-					 		== 0)
-						lock_status = 'K';
-					else
-						lock_status = 'T';
-				}
-				else
-					lock_status = 'O';
-			}
-			else if (status->entry && status->entry->lock_token)
-				lock_status = 'B';
-			else
-				lock_status = ' ';
-		}
-		else
-			lock_status = (status->entry && status->entry->lock_token) ? 'K' : ' ';
+	if (name != NULL) {
+		APR_ARRAY_PUSH (bt->names, const char *) = name;
+		APR_ARRAY_PUSH (bt->dirents, svn_dirent_t *) = svn_dirent_dup (dirent, job->pool);
+	}
+	return SVN_NO_ERROR;
+}
 
 
-		if (show_last_committed)
-		{
-		   	const char *commit_rev;
-			const char *commit_author;
+static svn_error_t *
+list_job_run (job_t *job, luasvn_client *client, apr_pool_t *pool) {
+	list_job_bt *bt = job->baton;
 
-			if (status->entry && SVN_IS_VALID_REVNUM(status->entry->cmt_rev))
-				commit_rev = apr_psprintf(pool, "%ld", status->entry->cmt_rev);
-			else if (status->entry) 
-				commit_rev = " ? ";
-			else 
-				commit_rev = "";
+	return cached_list (&bt->args, list_job_func, job, client, pool);
+}
 
 
-			if (status->entry && status->entry->cmt_author)
-				commit_author = status->entry->cmt_author;
-			else if (status->entry)
-				commit_author = " ? ";
-			else
-				commit_author = "";
+static int
+list_job_push (lua_State *L, job_t *job) {
+	list_job_bt *bt = job->baton;
+	int i;
+
+	lua_createtable (L, 0, bt->names->nelts);
+	for (i = 0; i < bt->names->nelts; i++) {
+		lua_pushstring (L, APR_ARRAY_IDX (bt->names, i, const char *));
+		push_dirent (L, APR_ARRAY_IDX (bt->dirents, i, svn_dirent_t *), bt->args.fields,
+					 bt->args.time, job->pool);
+		lua_settable (L, -3);
+	}
+	return 1;
+}
 
 
-			info = apr_psprintf(pool, 			
-					"%c%c%c%c%c%c %c   %6s   %6s %-12s %s",
-					generate_status_code(status->text_status),
-					generate_status_code(status->prop_status),
-					status->locked ? 'L' : ' ',
-					status->copied ? '+' : ' ',
-					status->switched ? 'S' : ' ',
-					lock_status,
-					ood_status,
-					working_rev,
-					commit_rev,
-					commit_author,
-					path);
+static int
+l_async_list (lua_State *L) {
+	job_t *job;
+	list_job_bt *bt;
+	list_args args;
+	luasvn_client *client = get_client (L);
 
-		}
-		else {
-			info = apr_psprintf(pool, 
-					"%c%c%c%c%c%c %c   %6s   %s\n",
-					generate_status_code(status->text_status),
-					generate_status_code(status->prop_status),
-					status->locked ? 'L' : ' ',
-					status->copied ? '+' : ' ',
-					status->switched ? 'S' : ' ',
-					lock_status,
-					ood_status,
-					working_rev,
-					path);
-		}
-	}
-	else {
-		info = apr_psprintf(pool,
-			   	"%c%c%c%c%c%c %s\n",
-				generate_status_code(status->text_status),
-				generate_status_code(status->prop_status),
-				status->locked ? 'L' : ' ',
-				status->copied ? '+' : ' ',
-				status->switched ? 'S' : ' ',
-				((status->entry && status->entry->lock_token)
-				 ? 'K' : ' '),
-				path);
-	}
+	get_list_args (L, 3, &args);
 
-	lua_pushstring (L, info);
-	lua_setfield (L, -2, path);
+	job = new_job (L, client, 3, list_job_run, list_job_push);
+
+	bt = apr_palloc (job->pool, sizeof (list_job_bt));
+	bt->args = args;
+	bt->args.path = svn_path_canonicalize (args.path, job->pool);
+	bt->names = apr_array_make (job->pool, 16, sizeof (const char *));
+	bt->dirents = apr_array_make (job->pool, 16, sizeof (svn_dirent_t *));
+	job->baton = bt;
+
+	return submit_job (L, job);
+}
+
+
+typedef struct log_job_bt {
+	log_args args;
+	apr_array_header_t *entries;
+} log_job_bt;
+
+
+static svn_error_t *
+log_job_receiver (void *baton, svn_log_entry_t *le, apr_pool_t *pool) {
+	job_t *job = baton;
+	log_job_bt *bt = job->baton;
+
+	APR_ARRAY_PUSH (bt->entries, svn_log_entry_t *) = svn_log_entry_dup (le, job->pool);
 	return SVN_NO_ERROR;
 }
 
 
 static svn_error_t *
-status_func (void *baton, const char *path, svn_wc_status2_t *status, apr_pool_t *pool) {
-	struct status_bt *sb = baton;
-	
-	print_status (svn_path_local_style (path, pool), 
-			      sb->detailed, sb->show_last_committed, sb->repos_locks,
-				  status, ((status_bt *) baton)->L, pool);
+log_job_run (job_t *job, luasvn_client *client, apr_pool_t *pool) {
+	log_job_bt *bt = job->baton;
 
-	return SVN_NO_ERROR;	
+	return cached_log (&bt->args, log_job_receiver, job, client, pool);
 }
 
 
 static int
-l_status (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-	
-	svn_revnum_t rev;	
-	status_bt baton;
-	svn_opt_revision_t revision;
-	
-	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
-	int itable = 3;
-	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t verbose = FALSE;
-	svn_boolean_t show_updates = FALSE;
-	svn_boolean_t no_ignore = FALSE;
-	svn_boolean_t ignore_externals = FALSE;
+log_job_push (lua_State *L, job_t *job) {
+	log_job_bt *bt = job->baton;
+	int i;
 
-	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		revision.kind = svn_opt_revision_head;
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 2);
+	lua_newtable (L);
+	for (i = 0; i < bt->entries->nelts; i++) {
+		svn_log_entry_t *le = APR_ARRAY_IDX (bt->entries, i, svn_log_entry_t *);
+
+		lua_pushinteger (L, le->revision);
+		push_log_entry (L, le, bt->args.time, bt->args.paths, job->pool);
+		lua_settable (L, -3);
 	}
+	return 1;
+}
 
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "verbose", -1, &verbose);
-		getboolfield(L, itable, "show_updates", -1, &show_updates);
-		getboolfield(L, itable, "no_ignore", -1, &no_ignore);
-		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
-	} 
 
-	init_function (&ctx, &pool, L);
+static int
+l_async_log (lua_State *L) {
+	job_t *job;
+	log_job_bt *bt;
+	log_args args;
+	luasvn_client *client = get_client (L);
 
-	path = svn_path_canonicalize (path, pool);
+	get_log_args (L, 4, 5, &args);
 
-	baton.L = L;
-	baton.detailed = (verbose || show_updates);
-	baton.show_last_committed = verbose;
-	baton.repos_locks = show_updates;
+	job = new_job (L, client, 5, log_job_run, log_job_push);
 
-	lua_newtable (L);
+	bt = apr_palloc (job->pool, sizeof (log_job_bt));
+	bt->args = args;
+	bt->args.path = svn_path_canonicalize (args.path, job->pool);
+	getrevpropsfield (L, 5, &bt->args, job->pool);
+	bt->entries = apr_array_make (job->pool, 64, sizeof (svn_log_entry_t *));
+	job->baton = bt;
 
-	err = svn_client_status4 (&rev, path, &revision, status_func, &baton, depth, verbose,
-			                  show_updates, no_ignore, ignore_externals, NULL, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);
+	return submit_job (L, job);
+}
 
-	svn_pool_destroy (pool);
+
+/* Returns the descriptor that becomes readable when jobs finish, to be
+   watched by an event loop */
+static int
+l_async_fd (lua_State *L) {
+	async_pool_t *async = get_async (L, get_client (L));
+	apr_os_file_t fd;
+
+	apr_os_file_get (&fd, async->notify_read);
+	lua_pushinteger (L, fd);
 	return 1;
 }
 
 
+/* Empties the descriptor and returns the jobs that finished since the
+   last call. Collected jobs are left out. */
 static int
-l_update (lua_State *L) {
-	apr_pool_t *pool;
-	svn_error_t *err;
-	svn_client_ctx_t *ctx;
-	
-	apr_array_header_t *array;
-	svn_opt_revision_t revision;
-	
-	const char *path = (lua_gettop (L) < 1 || lua_isnil (L, 1)) ? "" : luaL_checkstring (L, 1);
-	int itable = 3;
-	svn_depth_t depth = svn_depth_infinity;
-	svn_boolean_t depth_is_sticky = FALSE;
-	svn_boolean_t ignore_externals = FALSE;
-	svn_boolean_t allow_unver_obstructions = FALSE;
-	apr_array_header_t *result_revs = NULL;
+l_async_completed (lua_State *L) {
+	luasvn_client *client = get_client (L);
+	async_pool_t *async = client->async;
+	char buffer[64];
+	apr_size_t len;
+	job_t *job;
+	int n = 0;
 
-	if (lua_gettop (L) < 2 || lua_isnil (L, 2)) {
-		revision.kind = svn_opt_revision_head;
-	} else {
-		revision.kind = svn_opt_revision_number;
-		revision.value.number = lua_tointeger (L, 2);
+	lua_newtable (L);
+	if (async == NULL) {
+		return 1;
 	}
-	if (lua_gettop (L) >= itable && lua_istable (L, itable)) {
-		getdepthfield(L, itable, -1, &depth);
-		getboolfield(L, itable, "depth_is_sticky", -1, &depth_is_sticky);
-		getboolfield(L, itable, "ignore_externals", -1, &ignore_externals);
-		getboolfield(L, itable, "allow_unver_obstructions", -1, &allow_unver_obstructions);
-	} 
 
-	init_function (&ctx, &pool, L);
+	do {
+		len = sizeof (buffer);
+	} while (apr_file_read (async->notify_read, buffer, &len) == APR_SUCCESS && len > 0);
 
-	path = svn_path_canonicalize (path, pool);
+	lua_getfield (L, LUA_REGISTRYINDEX, LUASVN_JOBS);
 
-	array = apr_array_make (pool, 1, sizeof (const char *));
-	(*((const char **) apr_array_push (array))) = path;
+	/* One job at a time, since adding to the table may run the
+	   collector, which takes the mutex to free jobs */
+	for (;;) {
+		apr_thread_mutex_lock (async->mutex);
+		job = async->finished;
+		if (job != NULL) {
+			async->finished = job->next;
+			job->next = NULL;
+		}
+		apr_thread_mutex_unlock (async->mutex);
 
-	err = svn_client_update3 (&result_revs, array, &revision, depth, depth_is_sticky,
-							  ignore_externals, allow_unver_obstructions, ctx, pool);
-	IF_ERROR_RETURN (err, pool, L);	
+		if (job == NULL) {
+			break;
+		}
 
-	if (result_revs == NULL) {
-		lua_pushnil (L);
-	} else {
-		int rev = (int) ((int **) (result_revs->elts))[0];
-		lua_pushinteger (L, rev);
+		lua_pushlightuserdata (L, job);
+		lua_rawget (L, -2);
+		if (lua_isnil (L, -1)) {
+			lua_pop (L, 1);
+		} else {
+			lua_rawseti (L, -3, ++n);
+		}
 	}
 
-	svn_pool_destroy (pool);
+	lua_pop (L, 1);
 	return 1;
 }
 
 
+/* The functions of svn.async. The operations take the arguments of the
+   operation of the same name and return a job. */
+static const struct luaL_Reg svn_async [] = {
+	{"cat", l_async_cat},
+	{"completed", l_async_completed},
+	{"fd", l_async_fd},
+	{"list", l_async_list},
+	{"log", l_async_log},
+	{NULL, NULL}
+};
+
+
+static const struct luaL_Reg job_methods [] = {
+	{"cancel", job_cancel},
+	{"done", job_done},
+	{"wait", job_wait},
+	{NULL, NULL}
+};
+
+
 static const struct luaL_Reg svn [] = {
 	{"add", l_add},
+	{"cache_stats", l_cache_stats},
+	{"cancel_token", l_cancel_token},
 	{"cat", l_cat},
+	{"cat_iter", l_cat_iter},
+	{"cat_many", l_cat_many},
+	{"cat_stream", l_cat_stream},
+	{"cat_to", l_cat_to},
 	{"checkout", l_checkout},
 	{"commit", l_commit},
 	{"cleanup", l_cleanup},
+	{"configure", l_configure},
 	{"copy", l_copy},
 	{"delete", l_delete},
 	{"diff", l_diff},
 	{"import", l_import},
 	{"list", l_list},
+	{"list_each", l_list_each},
 	{"log", l_log},
+	{"log_iter", l_log_iter},
 	{"merge", l_merge},
 	{"mkdir", l_mkdir},
 	{"move", l_move},
 	{"propget", l_propget},
 	{"proplist", l_proplist},
+	{"proplist_each", l_proplist_each},
 	{"propset", l_propset},
 	{"repos_create", l_repos_create},
 	{"repos_delete", l_repos_delete},
 	{"revprop_get", l_revprop_get},
 	{"revprop_list", l_revprop_list},
 	{"revprop_set", l_revprop_set},
+	{"session_stats", l_session_stats},
 	{"status", l_status},
+	{"status_each", l_status_each},
+	{"txn", l_txn},
 	{"update", l_update},
 	{NULL, NULL}
 };
 
+
+/* Calls the function bound to the client, dropping the client passed
+   by the method call syntax */
+static int
+client_method (lua_State *L) {
+	luaL_checkudata (L, 1, LUASVN_CLIENT);
+	lua_remove (L, 1);
+	lua_pushvalue (L, lua_upvalueindex (1));
+	lua_insert (L, 1);
+	lua_call (L, lua_gettop (L) - 1, LUA_MULTRET);
+	return lua_gettop (L);
+}
+
+
+static int
+client_index (lua_State *L) {
+	luaL_checkudata (L, 1, LUASVN_CLIENT);
+	lua_getfenv (L, 1);
+	lua_pushvalue (L, 2);
+	lua_rawget (L, -2);
+	return 1;
+}
+
+
+static int
+client_gc (lua_State *L) {
+	luasvn_client *client = luaL_checkudata (L, 1, LUASVN_CLIENT);
+
+	if (client->pool != NULL) {
+		async_shutdown (client);
+		cat_cache_trim (client, 0);
+		client->cat_cache.entries = NULL;
+		/* The listings are in subpools */
+		client->list_cache.entries = NULL;
+		client->list_cache.head = client->list_cache.tail = NULL;
+		svn_pool_destroy (client->pool);
+		client->pool = NULL;
+		client->sessions = NULL;
+		client->nsessions = 0;
+	}
+	return 0;
+}
+
+
+static void
+getstringfield (lua_State *L, int itable, const char *field,
+				int index, const char **s, apr_pool_t *pool) {
+	lua_getfield (L, itable, field);
+	if (lua_isstring (L, index)) {
+		*s = apr_pstrdup (pool, lua_tostring (L, index));
+	}
+}
+
+
+/* Pushes a new client built with the options of the table at ITABLE,
+   if there is one */
+static int
+push_client (lua_State *L, int itable) {
+	luasvn_client *client;
+	apr_pool_t *pool;
+	svn_error_t *err;
+	const struct luaL_Reg *reg;
+	int iclient;
+
+	client = lua_newuserdata (L, sizeof (luasvn_client));
+	memset (client, 0, sizeof (luasvn_client));
+	iclient = lua_gettop (L);
+	luaL_getmetatable (L, LUASVN_CLIENT);
+	lua_setmetatable (L, iclient);
+
+	pool = create_pool ();
+	if (pool == NULL) {
+		return send_error (L, "Error creating allocator\n");
+	}
+
+	/* Set first, as the configuration allocates in it */
+	client->pool = pool;
+	client->max_sessions = DEFAULT_MAX_SESSIONS;
+	client->session_idle = apr_time_from_sec (DEFAULT_SESSION_IDLE);
+	client->async_threads = DEFAULT_ASYNC_THREADS;
+
+	if (itable != 0 && lua_istable (L, itable)) {
+		getstringfield(L, itable, "config_dir", -1, &client->opts.config_dir, pool);
+		getstringfield(L, itable, "username", -1, &client->opts.username, pool);
+		getstringfield(L, itable, "password", -1, &client->opts.password, pool);
+		getboolfield(L, itable, "non_interactive", -1, &client->opts.non_interactive);
+		getboolfield(L, itable, "no_auth_cache", -1, &client->opts.no_auth_cache);
+		getboolfield(L, itable, "trust_server_cert", -1, &client->opts.trust_server_cert);
+		configure_client (L, client, itable);
+	}
+
+	err = create_context (&client->ctx, &client->opts, pool);
+	if (err) {
+		client->pool = NULL;
+	}
+	IF_ERROR_RETURN (err, pool, L);
+
+	client->ctx->cancel_func = client_cancel;
+	client->ctx->cancel_baton = client;
+
+	/* Every function of the module is a method of the client */
+	lua_newtable (L);
+	for (reg = svn; reg->name != NULL; reg++) {
+		lua_pushvalue (L, iclient);
+		lua_pushcclosure (L, reg->func, 1);
+		lua_pushcclosure (L, client_method, 1);
+		lua_setfield (L, -2, reg->name);
+	}
+	lua_pushcfunction (L, client_gc);
+	lua_setfield (L, -2, "close");
+
+	lua_newtable (L);
+	for (reg = svn_async; reg->name != NULL; reg++) {
+		lua_pushvalue (L, iclient);
+		lua_pushcclosure (L, reg->func, 1);
+		lua_setfield (L, -2, reg->name);
+	}
+	lua_setfield (L, -2, "async");
+	lua_setfenv (L, iclient);
+
+	lua_settop (L, iclient);
+	return 1;
+}
+
+
+/* Gets the client of the running function: the first upvalue of the
+   methods of a client, or else the default client, which is created on
+   first use */
+static luasvn_client *
+get_client (lua_State *L) {
+	luasvn_client *client = lua_touserdata (L, lua_upvalueindex (1));
+
+	if (client == NULL) {
+		lua_getfield (L, LUA_REGISTRYINDEX, LUASVN_DEFAULT_CLIENT);
+		client = lua_touserdata (L, -1);
+		lua_pop (L, 1);
+
+		if (client == NULL) {
+			push_client (L, 0);
+			client = lua_touserdata (L, -1);
+			lua_setfield (L, LUA_REGISTRYINDEX, LUASVN_DEFAULT_CLIENT);
+		}
+	}
+
+	if (client->pool == NULL) {
+		send_error (L, "Client is closed\n");
+	}
+	return client;
+}
+
+
+static int
+l_client (lua_State *L) {
+	return push_client (L, 1);
+}
+
+
 LUASVN_API
 luaopen_svn (lua_State *L) {
+	const char *message = init_libraries ();
+	int i;
+
+	if (message != NULL) {
+		return send_error (L, message);
+	}
+
+	luaL_newmetatable (L, LUASVN_CLIENT);
+	lua_pushcfunction (L, client_index);
+	lua_setfield (L, -2, "__index");
+	lua_pushcfunction (L, client_gc);
+	lua_setfield (L, -2, "__gc");
+	lua_pop (L, 1);
+
+	luaL_newmetatable (L, LUASVN_PRODUCER);
+	lua_newtable (L);
+	luaL_register (L, NULL, producer_methods);
+	lua_setfield (L, -2, "__index");
+	lua_pushcfunction (L, producer_close);
+	lua_setfield (L, -2, "__gc");
+	lua_pop (L, 1);
+
+	luaL_newmetatable (L, LUASVN_TXN);
+	lua_newtable (L);
+	luaL_register (L, NULL, txn_methods);
+	lua_setfield (L, -2, "__index");
+	lua_pushcfunction (L, txn_gc);
+	lua_setfield (L, -2, "__gc");
+	lua_pop (L, 1);
+
+	luaL_newmetatable (L, LUASVN_CANCEL);
+	lua_newtable (L);
+	luaL_register (L, NULL, cancel_token_methods);
+	lua_setfield (L, -2, "__index");
+	lua_pop (L, 1);
+
+	luaL_newmetatable (L, LUASVN_JOB);
+	lua_newtable (L);
+	luaL_register (L, NULL, job_methods);
+	lua_setfield (L, -2, "__index");
+	lua_pushcfunction (L, job_gc);
+	lua_setfield (L, -2, "__gc");
+	lua_pop (L, 1);
+
+	/* Handles of the jobs, by job, for completed */
+	lua_newtable (L);
+	lua_newtable (L);
+	lua_pushliteral (L, "v");
+	lua_setfield (L, -2, "__mode");
+	lua_setmetatable (L, -2);
+	lua_setfield (L, LUA_REGISTRYINDEX, LUASVN_JOBS);
+
 	luaL_register (L, "svn", svn);
+
+	lua_newtable (L);
+	luaL_register (L, NULL, svn_async);
+	lua_setfield (L, -2, "async");
+
+	lua_pushcfunction (L, l_client);
+	lua_setfield (L, -2, "client");
+
+	lua_newtable (L);
+	for (i = 0; status_kinds[i].name != NULL; i++) {
+		lua_pushinteger (L, status_kinds[i].kind);
+		lua_setfield (L, -2, status_kinds[i].name);
+	}
+	lua_setfield (L, -2, "status_kinds");
 	return 1;
 }
 
@@ -0,0 +1,83 @@
+-- Tests of svn.async, operations run by a pool of worker threads
+
+local svn = require "svn"
+local t = require "common"
+
+local function tree ()
+	return t.repos ({["a.txt"] = "a", ["b.txt"] = "bb", ["dir/c.txt"] = "ccc"})
+end
+
+-- Waits, without blocking in the module, for the job to finish
+local function spin (job)
+	while not job:done () do
+		os.execute ("sleep 0.01")
+	end
+end
+
+t.test ("async cat, list and log give what the blocking calls give", function ()
+	local url = tree ()
+	t.commit (url, {["a.txt"] = "a2"}, "second")
+	local client = svn.client ()
+
+	local cat = client.async.cat (url .. "/a.txt")
+	local old = client.async.cat (url .. "/a.txt", 1)
+	local list = client.async.list (url)
+	local log = client.async.log (url)
+
+	t.equal (cat:wait (), "a2", "cat")
+	t.equal (old:wait (), "a", "cat of revision 1")
+	t.equal (list:wait ()["b.txt"].size, 2, "list")
+	t.equal (log:wait ()[2].message, "second", "log")
+	assert (cat:done (), "done")
+	client:close ()
+end)
+
+t.test ("many jobs in flight on many threads", function ()
+	local url = tree ()
+	local client = svn.client ()
+	client:configure ({async_threads = 4})
+
+	local jobs = {}
+	for i = 1, 20 do
+		jobs[i] = client.async.cat (url .. (i % 2 == 0 and "/b.txt" or "/dir/c.txt"))
+	end
+	for i = 1, 20 do
+		t.equal (jobs[i]:wait (), i % 2 == 0 and "bb" or "ccc", "job " .. i)
+	end
+	client:close ()
+end)
+
+t.test ("a failed job raises its error on wait", function ()
+	local url = tree ()
+	local job = svn.async.cat (url .. "/missing.txt")
+	t.raises ("", job.wait, job)
+	assert (job:done (), "done")
+end)
+
+t.test ("completed gives the finished jobs once", function ()
+	local url = tree ()
+	local client = svn.client ()
+	local fd = client.async.fd ()
+	assert (type (fd) == "number" and fd > 2, "descriptor")
+
+	local job = client.async.cat (url .. "/a.txt")
+	spin (job)
+	local done = client.async.completed ()
+	t.equal (#done, 1, "completed")
+	assert (done[1] == job, "same job")
+	t.equal (done[1]:wait (), "a", "result")
+	t.equal (#client.async.completed (), 0, "once")
+	client:close ()
+end)
+
+t.test ("unwaited jobs are collected", function ()
+	local url = tree ()
+	local client = svn.client ()
+	for i = 1, 10 do
+		client.async.list (url)
+	end
+	collectgarbage ()
+	collectgarbage ()
+	t.equal (client:cat (url .. "/a.txt"), "a", "client still works")
+	client:close ()
+end)
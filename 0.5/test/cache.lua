@@ -0,0 +1,111 @@
+-- Tests of the cat, disk and list caches
+
+local svn = require "svn"
+local t = require "common"
+
+t.test ("the cat cache serves a file read again", function ()
+	local url = t.repos ({["a.txt"] = "aaa", ["big.txt"] = string.rep ("b", 4096)})
+	local client = svn.client ({cat_cache_size = 1024})
+
+	t.equal (client:cat (url .. "/a.txt"), "aaa")
+	t.equal (client:cat (url .. "/a.txt"), "aaa")
+	local stats = client:cache_stats ().cat
+	t.equal (stats.hits, 1, "hits")
+	t.equal (stats.entries, 1, "entries")
+	t.equal (stats.size, 3, "size")
+
+	-- Over the size of the cache
+	client:cat (url .. "/big.txt")
+	client:cat (url .. "/big.txt")
+	t.equal (client:cache_stats ().cat.hits, 1, "hits of a large file")
+
+	client:configure ({cat_cache_size = 0})
+	t.equal (client:cache_stats ().cat.entries, 0, "entries once disabled")
+	client:close ()
+end)
+
+t.test ("the cat cache keeps revisions apart", function ()
+	local url = t.repos ({["a.txt"] = "1"})
+	t.commit (url, {["a.txt"] = "2"})
+	local client = svn.client ({cat_cache_size = 1024})
+
+	t.equal (client:cat (url .. "/a.txt"), "2", "HEAD")
+	t.equal (client:cat (url .. "/a.txt", 1), "1", "revision 1")
+	t.equal (client:cat (url .. "/a.txt", 2), "2", "revision 2")
+	t.equal (client:cat (url .. "/a.txt"), "2", "HEAD again")
+	t.equal (client:cache_stats ().cat.hits, 2, "hits")
+	client:close ()
+end)
+
+t.test ("the disk cache outlives its client", function ()
+	local url = t.repos ({["a.txt"] = "aaa", ["b.txt"] = "aaa"})
+	local dir = t.tmpdir ()
+
+	local client = svn.client ({cache_dir = dir})
+	t.equal (client:cat (url .. "/a.txt"), "aaa")
+	t.equal (client:cache_stats ().disk.stores, 1, "stores")
+	client:close ()
+
+	client = svn.client ({cache_dir = dir})
+	t.equal (client:cat (url .. "/a.txt"), "aaa")
+	t.equal (client:cache_stats ().disk.hits, 1, "hits")
+
+	-- Same contents at another path: read again, stored once
+	t.equal (client:cat (url .. "/b.txt"), "aaa")
+	t.equal (client:cache_stats ().disk.misses, 1, "misses")
+	client:close ()
+end)
+
+t.test ("the disk cache finds an unchanged file at a new HEAD", function ()
+	local url = t.repos ({["a.txt"] = "aaa", ["b.txt"] = "bbb"})
+	local dir = t.tmpdir ()
+	local client = svn.client ({cache_dir = dir})
+
+	client:cat (url .. "/a.txt")
+	t.commit (url, {["b.txt"] = "ccc"})
+	t.equal (client:cat (url .. "/a.txt"), "aaa")
+	t.equal (client:cache_stats ().disk.hits, 1, "hits")
+
+	-- The translated contents go to cat_to too
+	local path = t.tmpdir () .. "/a.txt"
+	client:cat_to (url .. "/a.txt", nil, path)
+	t.equal (t.readfile (path), "aaa")
+	client:close ()
+end)
+
+t.test ("the disk cache survives broken files", function ()
+	local url = t.repos ({["a.txt"] = "aaa"})
+	local dir = t.tmpdir ()
+	local client = svn.client ({cache_dir = dir})
+
+	client:cat (url .. "/a.txt")
+	t.rmtree (dir .. "/objects")
+	t.equal (client:cat (url .. "/a.txt"), "aaa")
+	t.equal (client:cache_stats ().disk.stores, 2, "stores")
+	client:close ()
+end)
+
+t.test ("the list cache revalidates HEAD listings", function ()
+	local url = t.repos ({["a.txt"] = "a", ["dir/b.txt"] = "b"})
+	local client = svn.client ({list_cache_size = 8})
+
+	t.equal (client:list (url .. "/dir")["b.txt"].size, 1, "first")
+	t.equal (client:list (url .. "/dir")["b.txt"].size, 1, "second")
+	local stats = client:cache_stats ().list
+	t.equal (stats.misses, 1, "misses")
+	t.equal (stats.hits, 1, "hits")
+
+	-- A change elsewhere leaves the directory as it was
+	t.commit (url, {["a.txt"] = "a2"})
+	client:list (url .. "/dir")
+	t.equal (client:cache_stats ().list.hits, 2, "hits after another change")
+
+	t.commit (url, {["dir/b.txt"] = "b3"})
+	t.equal (client:list (url .. "/dir")["b.txt"].size, 2, "changed")
+	t.equal (client:cache_stats ().list.misses, 2, "misses after a change")
+	t.equal (client:list (url .. "/dir", 2)["b.txt"].size, 1, "older revision")
+
+	client:configure ({list_cache_size = 0})
+	t.equal (client:cache_stats ().list.entries, 0, "entries once disabled")
+	client:close ()
+end)
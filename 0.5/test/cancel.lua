@@ -0,0 +1,68 @@
+-- Tests of cancel tokens and timeouts
+
+local svn = require "svn"
+local t = require "common"
+
+local function tree ()
+	return t.repos ({["a.txt"] = "a", ["dir/b.txt"] = "b", ["dir/sub/c.txt"] = "c"})
+end
+
+t.test ("cancel tokens", function ()
+	local token = svn.cancel_token ()
+	assert (not token:cancelled (), "new")
+	token:cancel ()
+	assert (token:cancelled (), "cancelled")
+	t.raises ("cancel token", svn.list, tree (), nil, {cancel = {}})
+end)
+
+t.test ("a cancelled token stops a call", function ()
+	local url = tree ()
+	local token = svn.cancel_token ()
+	token:cancel ()
+	t.raises ("Operation cancelled", svn.checkout, url, t.tmpdir () .. "/wc", nil, {cancel = token})
+	t.raises ("Operation cancelled", svn.list, url, nil, {depth = "infinity", cancel = token})
+	t.equal (svn.cat (url .. "/a.txt"), "a", "later calls")
+end)
+
+t.test ("a call stops once its timeout is over", function ()
+	local url = tree ()
+	t.raises ("Operation timed out", svn.checkout, url, t.tmpdir () .. "/wc", nil, {timeout = 1e-6})
+	assert (svn.list (url .. "/dir", nil, {depth = "infinity", timeout = 60})["sub/c.txt"], "long timeout")
+end)
+
+t.test ("the timeout of a client", function ()
+	local url = tree ()
+	local client = svn.client ({timeout = 1e-6})
+	t.raises ("Operation timed out", client.checkout, client, url, t.tmpdir () .. "/wc")
+	client:configure ({timeout = 0})
+	client:checkout (url, t.tmpdir () .. "/wc")
+	client:close ()
+end)
+
+t.test ("a cancelled token stops an iterator", function ()
+	local url = tree ()
+	local token = svn.cancel_token ()
+	token:cancel ()
+	local next, it = svn.log_iter (url, nil, nil, {cancel = token})
+	t.raises ("Operation cancelled", next, it)
+	it:close ()
+end)
+
+t.test ("jobs are cancelled with their own method", function ()
+	local url = tree ()
+	local client = svn.client ({async_threads = 1})
+	t.raises ("cancel method", client.async.list, url, nil, {cancel = svn.cancel_token ()})
+
+	local job = client.async.list (url, nil, {depth = "infinity", timeout = 1e-6})
+	t.raises ("Operation timed out", job.wait, job)
+
+	local jobs = {}
+	for i = 1, 5 do
+		jobs[i] = client.async.list (url, nil, {depth = "infinity"})
+	end
+	jobs[5]:cancel ()
+	local ok, err = pcall (jobs[5].wait, jobs[5])
+	assert (ok or tostring (err):match ("Operation cancelled"), tostring (err))
+	assert (jobs[1]:wait ()["dir/sub/c.txt"], "other jobs")
+	client:close ()
+end)
@@ -0,0 +1,94 @@
+-- Tests of cat, cat_stream and cat_to
+
+local svn = require "svn"
+local t = require "common"
+
+local TEXT = "one\n$Rev$\ntwo\n"
+local EXPANDED = "one\r\n$Rev: 1 $\r\ntwo\r\n"
+
+local function translated_repos ()
+	return t.repos ({["trunk/a.txt"] = TEXT},
+		{["trunk/a.txt"] = {["svn:eol-style"] = "CRLF", ["svn:keywords"] = "Rev"}})
+end
+
+t.test ("cat translates end of lines and keywords", function ()
+	local url = translated_repos ()
+	t.equal (svn.cat (url .. "/trunk/a.txt"), EXPANDED, "HEAD")
+	t.equal (svn.cat (url .. "/trunk/a.txt", 1), EXPANDED, "revision 1")
+end)
+
+t.test ("cat_stream hands the translated contents", function ()
+	local url = translated_repos ()
+	local chunks = {}
+	svn.cat_stream (url .. "/trunk/a.txt", nil, function (data)
+		chunks[#chunks + 1] = data
+	end)
+	t.equal (table.concat (chunks), EXPANDED)
+end)
+
+t.test ("cat_to writes a translated file to a path", function ()
+	local url = translated_repos ()
+	local path = t.tmpdir () .. "/a.txt"
+	svn.cat_to (url .. "/trunk/a.txt", nil, path)
+	t.equal (t.readfile (path), EXPANDED)
+	svn.cat_to (url .. "/trunk/a.txt", 1, path, {fsync = true})
+	t.equal (t.readfile (path), EXPANDED, "fsync")
+end)
+
+t.test ("cat_to writes a translated file to a descriptor and leaves it open", function ()
+	local url = translated_repos ()
+	local out = t.tmpdir () .. "/out"
+	assert (t.spawn (string.format ([[
+		local svn = require "svn"
+		io.stdout:setvbuf ("no")
+		svn.cat_to (%q, nil, 1)
+		io.write ("[end]")
+	]], url .. "/trunk/a.txt"), out))
+	t.equal (t.readfile (out), EXPANDED .. "[end]")
+end)
+
+t.test ("sessions are reused", function ()
+	local url = translated_repos ()
+	local client = svn.client ()
+	client:cat (url .. "/trunk/a.txt")
+	local misses = client:session_stats ().misses
+	client:cat (url .. "/trunk/a.txt", 1)
+	t.equal (client:session_stats ().misses, misses, "misses")
+	assert (client:session_stats ().hits > 0)
+	client:close ()
+end)
+
+t.test ("a missing file does not drop the session", function ()
+	local url = translated_repos ()
+	local client = svn.client ()
+	client:cat (url .. "/trunk/a.txt")
+	local misses = client:session_stats ().misses
+	t.raises ("", client.cat, client, url .. "/trunk/missing.txt")
+	client:cat (url .. "/trunk/a.txt")
+	t.equal (client:session_stats ().misses, misses, "misses")
+	client:close ()
+end)
+
+t.test ("cat_many reads many files over one session", function ()
+	local url = t.repos ({["a.txt"] = "a", ["dir/b.txt"] = "b", ["dir/c.txt"] = TEXT},
+		{["dir/c.txt"] = {["svn:eol-style"] = "CRLF", ["svn:keywords"] = "Rev"}})
+	t.commit (url, {["a.txt"] = "a2"})
+	local urls = {url .. "/a.txt", url .. "/dir/b.txt", url .. "/dir/c.txt"}
+	local client = svn.client ()
+
+	local files = client:cat_many (urls)
+	t.equal (files[urls[1]], "a2", "HEAD")
+	t.equal (files[urls[2]], "b", "other directory")
+	t.equal (files[urls[3]], EXPANDED, "translated")
+	t.equal (client:session_stats ().misses, 1, "sessions")
+
+	t.equal (client:cat_many (urls, 1)[urls[1]], "a", "revision 1")
+
+	local seen = {}
+	client:cat_many (urls, nil, function (u, data)
+		seen[#seen + 1] = u
+		return #seen < 2
+	end)
+	t.equal (table.concat (seen, " "), urls[1] .. " " .. urls[2], "stopped")
+	client:close ()
+end)
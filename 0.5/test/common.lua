@@ -0,0 +1,140 @@
+-- Helpers shared by the tests. Every test gets a new repository, made
+-- with svn.repos_create in a temporary directory and reached through a
+-- file:// URL, so that the tests need no server.
+
+local svn = require "svn"
+
+local common = {}
+
+local tests = {}
+local garbage = {}
+
+-- Adds a test to the ones run by run.lua
+function common.test (name, func)
+	tests[#tests + 1] = {name = name, func = func}
+end
+
+function common.tests ()
+	return tests
+end
+
+-- Gets a name for a temporary file or directory that does not exist yet
+function common.tmpname ()
+	local name = os.tmpname ()
+	os.remove (name)
+	return name
+end
+
+function common.readfile (path)
+	local f = assert (io.open (path, "rb"))
+	local data = f:read ("*a")
+	f:close ()
+	return data
+end
+
+function common.writefile (path, data)
+	local f = assert (io.open (path, "wb"))
+	f:write (data)
+	f:close ()
+end
+
+function common.rmtree (path)
+	os.execute ("rm -rf '" .. path .. "'")
+end
+
+-- Gets a temporary directory removed once the running test is over
+function common.tmpdir ()
+	local dir = common.tmpname ()
+	assert (os.execute ("mkdir '" .. dir .. "'") == 0)
+	garbage[#garbage + 1] = dir
+	return dir
+end
+
+-- Removes what the last test left behind
+function common.cleanup ()
+	for _, path in ipairs (garbage) do
+		common.rmtree (path)
+	end
+	garbage = {}
+end
+
+-- Creates a repository. FILES, a table of path = contents, and PROPS, a
+-- table of path = {name = value}, are committed in revision 1. Gives the
+-- URL of the repository.
+function common.repos (files, props)
+	local dir = common.tmpname ()
+	svn.repos_create (dir)
+	garbage[#garbage + 1] = dir
+	local url = "file://" .. dir
+
+	if files then
+		local txn = svn.txn (url, "initial import")
+		local dirs = {}
+		for path, data in pairs (files) do
+			local parent = path:match ("^(.*)/[^/]*$")
+			while parent and not dirs[parent] do
+				dirs[parent] = true
+				parent = parent:match ("^(.*)/[^/]*$")
+			end
+			txn:put (path, data)
+		end
+		for path in pairs (dirs) do
+			txn:mkdir (path)
+		end
+		for path, list in pairs (props or {}) do
+			for name, value in pairs (list) do
+				txn:propset (path, name, value)
+			end
+		end
+		assert (txn:commit () == 1)
+	end
+
+	return url
+end
+
+-- Lets the revision properties of the repository at URL be changed
+function common.allow_revprop_change (url)
+	local hook = url:gsub ("^file://", "") .. "/hooks/pre-revprop-change"
+	common.writefile (hook, "#!/bin/sh\nexit 0\n")
+	assert (os.execute ("chmod +x '" .. hook .. "'") == 0)
+end
+
+-- Commits CONTENTS, a table of path = contents, to the repository at URL
+-- and gives the new revision
+function common.commit (url, contents, message)
+	local txn = svn.txn (url, message or "change")
+	for path, data in pairs (contents) do
+		if data == false then
+			txn:delete (path)
+		else
+			txn:put (path, data)
+		end
+	end
+	return txn:commit ()
+end
+
+-- Runs CODE in another Lua process with its standard output going to the
+-- file OUT. The process loads the module from the same place as this one.
+function common.spawn (code, out)
+	local script = common.tmpname ()
+	common.writefile (script, string.format ("package.cpath = %q\n%s", package.cpath, code))
+	local status = os.execute (string.format ("%s '%s' > '%s'", common.lua, script, out))
+	os.remove (script)
+	return status == 0
+end
+
+-- Checks that calling FUNC raises an error matching PATTERN
+function common.raises (pattern, func, ...)
+	local ok, err = pcall (func, ...)
+	assert (not ok, "no error raised")
+	assert (tostring (err):match (pattern), "unexpected error: " .. tostring (err))
+end
+
+function common.equal (got, expected, what)
+	if got ~= expected then
+		error (string.format ("%s: expected %q, got %q", what or "value",
+							  tostring (expected), tostring (got)), 2)
+	end
+end
+
+return common
@@ -0,0 +1,66 @@
+-- Tests of cat_iter and log_iter
+
+local svn = require "svn"
+local t = require "common"
+
+-- Over three chunks of the iterators
+local BIG = string.rep ("0123456789abcdef", 12 * 1024)
+
+local function history ()
+	local url = t.repos ({["big.bin"] = BIG, ["a.txt"] = "1"})
+	for i = 2, 5 do
+		t.commit (url, {["a.txt"] = tostring (i)}, "change " .. i)
+	end
+	return url
+end
+
+t.test ("cat_iter hands the contents in chunks", function ()
+	local url = history ()
+	local chunks = {}
+	for data in svn.cat_iter (url .. "/big.bin") do
+		chunks[#chunks + 1] = data
+	end
+	assert (#chunks > 1, "a single chunk")
+	t.equal (table.concat (chunks), BIG)
+end)
+
+t.test ("log_iter gives the revisions in order", function ()
+	local url = history ()
+	local revs = {}
+	for rev, entry in svn.log_iter (url, 1) do
+		revs[#revs + 1] = rev
+		if rev > 1 then
+			t.equal (entry.message, "change " .. rev, "message")
+		end
+	end
+	t.equal (table.concat (revs, ","), "1,2,3,4,5", "revisions")
+end)
+
+t.test ("an iterator left early is closed", function ()
+	local url = history ()
+	local next, it = svn.log_iter (url, 1)
+	for rev in next, it do
+		if rev == 2 then
+			break
+		end
+	end
+	it:close ()
+	it:close ()
+	assert (next () == nil, "values after close")
+
+	next, it = svn.cat_iter (url .. "/big.bin")
+	assert (next ())
+	it:close ()
+	assert (next () == nil, "values after close")
+end)
+
+t.test ("an abandoned iterator is collected", function ()
+	local url = history ()
+	for i = 1, 10 do
+		local next = svn.log_iter (url, 1)
+		next ()
+	end
+	collectgarbage ()
+	collectgarbage ()
+	t.equal (svn.cat (url .. "/a.txt"), "5")
+end)
@@ -0,0 +1,76 @@
+-- Tests of list, list_each and proplist_each
+
+local svn = require "svn"
+local t = require "common"
+
+local function tree ()
+	return t.repos ({["a.txt"] = "a", ["b.txt"] = "bb", ["c.txt"] = "ccc", ["dir/d.txt"] = "d"},
+		{["a.txt"] = {["test:one"] = "1", ["test:two"] = "2"}})
+end
+
+t.test ("list gives the entries of a directory", function ()
+	local url = tree ()
+	local list = svn.list (url)
+	t.equal (list["b.txt"].size, 2, "size")
+	t.equal (list["b.txt"].revision, 1, "revision")
+	assert (list["dir/"], "directory")
+	assert (list["dir/d.txt"] == nil, "entry below")
+end)
+
+t.test ("list_each stops when the function returns false", function ()
+	local url = tree ()
+	local names = {}
+	svn.list_each (url, nil, function (name, entry)
+		names[#names + 1] = name
+		return #names < 2
+	end)
+	t.equal (#names, 2, "entries")
+end)
+
+t.test ("list_each raises the error of the function", function ()
+	local url = tree ()
+	t.raises ("boom", svn.list_each, url, nil, function () error ("boom") end)
+	-- The session is still usable
+	t.equal (svn.cat (url .. "/a.txt"), "a")
+end)
+
+t.test ("proplist_each hands the properties of each path", function ()
+	local url = tree ()
+	local seen = {}
+	svn.proplist_each (url .. "/a.txt", nil, function (path, props)
+		seen[#seen + 1] = props
+	end)
+	t.equal (#seen, 1, "paths")
+	t.equal (seen[1]["test:one"], "1", "property")
+	t.equal (seen[1]["test:two"], "2", "property")
+end)
+
+t.test ("list gives only the fields asked for", function ()
+	local url = tree ()
+	local list = svn.list (url, nil, {fields = {"size"}})
+	t.equal (list["b.txt"].size, 2, "size")
+	assert (list["b.txt"].revision == nil and list["b.txt"].author == nil
+		and list["b.txt"].date == nil, "other fields")
+	assert (list["dir/"], "directory")
+
+	list = svn.list (url, nil, {fields = {}})
+	assert (list["a.txt"] and next (list["a.txt"]) == nil, "names only")
+
+	list = svn.list (url, nil, {fields = {"has_props", "revision"}})
+	t.equal (list["a.txt"].has_props, true, "properties")
+	t.equal (list["b.txt"].has_props, false, "no properties")
+	t.equal (list["b.txt"].revision, 1, "revision")
+
+	t.raises ("unknown list field", svn.list, url, nil, {fields = {"colour"}})
+end)
+
+t.test ("list gives dates as numbers", function ()
+	local url = tree ()
+	local usec = svn.list (url, nil, {time = "usec"})["a.txt"].date
+	local seconds = svn.list (url, nil, {time = "seconds"})["a.txt"].date
+	assert (type (usec) == "number" and type (seconds) == "number", "numbers")
+	assert (math.abs (usec / 1e6 - seconds) < 1e-3, "same date")
+	assert (math.abs (seconds - os.time ()) < 3600, "now")
+	assert (type (svn.list (url)["a.txt"].date) == "string", "string by default")
+	t.raises ("unknown time format", svn.list, url, nil, {time = "days"})
+end)
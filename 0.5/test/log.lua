@@ -0,0 +1,136 @@
+-- Tests of log and of the log cache
+
+local svn = require "svn"
+local t = require "common"
+
+local function history (n)
+	local url = t.repos ({["trunk/a.txt"] = "0"})
+	for i = 2, n do
+		t.commit (url, {["trunk/a.txt"] = tostring (i)}, "change " .. i)
+	end
+	return url
+end
+
+local function messages (log, first, last)
+	local list = {}
+	for rev = first, last do
+		list[#list + 1] = log[rev] and log[rev].message or "-"
+	end
+	return table.concat (list, ",")
+end
+
+local function cached_client ()
+	return svn.client ({cache_dir = t.tmpdir (), log_cache = true})
+end
+
+t.test ("the log cache answers from disk", function ()
+	local url = history (4)
+	local client = cached_client ()
+	local expected = messages (svn.log (url, 1), 1, 4)
+
+	t.equal (messages (client:log (url, 1), 1, 4), expected, "first")
+	t.equal (client:cache_stats ().log.syncs, 1, "syncs")
+	t.equal (messages (client:log (url, 1, 4), 1, 4), expected, "cached")
+	t.equal (client:cache_stats ().log.hits, 1, "hits")
+
+	t.equal (messages (client:log (url, 4, 2), 2, 4), "change 2,change 3,change 4", "backwards")
+	local n = 0
+	for rev in pairs (client:log (url, 1, 4, 2)) do
+		n = n + 1
+	end
+	t.equal (n, 2, "limit")
+	client:close ()
+end)
+
+t.test ("the log cache syncs new revisions", function ()
+	local url = history (3)
+	local client = cached_client ()
+
+	client:log (url, 1)
+	t.commit (url, {["trunk/b.txt"] = "b"}, "change 4")
+	local log = client:log (url, 1, nil, 0, {discover_changed_paths = true})
+	t.equal (messages (log, 3, 4), "change 3,change 4")
+	t.equal (log[4].changed_paths["/trunk/b.txt"].action, "A", "changed path")
+	t.equal (client:cache_stats ().log.syncs, 2, "syncs")
+	client:close ()
+end)
+
+t.test ("a log cache left changing by a crash is rebuilt", function ()
+	local url = history (3)
+	local dir = t.tmpdir ()
+	local client = svn.client ({cache_dir = dir, log_cache = true})
+	client:log (url, 1)
+
+	-- Sets the field of the header telling that a sync is changing the
+	-- intern table, as a sync killed in the middle leaves it
+	local name = io.popen ("find '" .. dir .. "/log' -name '*.rec'"):read ("*l")
+	local f = assert (io.open (name, "r+b"))
+	f:seek ("set", 28)
+	f:write ("\1")
+	f:close ()
+
+	t.commit (url, {["trunk/a.txt"] = "4"}, "change 4")
+	t.equal (messages (client:log (url, 1), 2, 4), "change 2,change 3,change 4")
+	t.equal (t.readfile (name):byte (29), 0, "changing")
+	t.equal (messages (client:log (url, 1, 4), 2, 4), "change 2,change 3,change 4", "cached")
+	client:close ()
+end)
+
+t.test ("the log cache keeps every revision property", function ()
+	local url = history (3)
+	t.allow_revprop_change (url)
+	svn.revprop_set (url, "test:prop", "x y", 2)
+	local client = cached_client ()
+
+	for _, opts in ipairs ({{}, {revprops = {"test:prop", "svn:log"}}}) do
+		local log = client:log (url, 1, nil, 0, opts)
+		t.equal (log[2].revprops["test:prop"], "x y", "revprop")
+		t.equal (log[2].message, "change 2", "message")
+		assert (log[3].revprops == nil, "revprops of revision 3")
+	end
+
+	-- Now from the cache
+	local log = client:log (url, 1, 3)
+	t.equal (log[2].revprops["test:prop"], "x y", "cached revprop")
+	log = client:log (url, 1, 3, 0, {revprops = {"svn:author"}})
+	assert (log[2].revprops == nil, "revprop not asked for")
+	assert (log[2].message == nil, "message not asked for")
+	t.equal (client:cache_stats ().log.hits, 2, "hits")
+	client:close ()
+end)
+
+t.test ("log gives dates as numbers", function ()
+	local url = history (2)
+	local usec = svn.log (url, 1, 2, 0, {time = "usec"})
+	local seconds = svn.log (url, 1, 2, 0, {time = "seconds"})
+	assert (type (usec[2].date) == "number", "usec")
+	assert (math.abs (usec[2].date / 1e6 - seconds[2].date) < 1e-3, "same date")
+	assert (usec[1].date <= usec[2].date, "order")
+	assert (type (svn.log (url, 1, 2)[2].date) == "string", "string by default")
+end)
+
+t.test ("compact changed paths", function ()
+	local url = history (1)
+	local txn = svn.txn (url, "branch")
+	txn:mkdir ("branches")
+	txn:copy ("trunk", 1, "branches/one")
+	txn:put ("trunk/b.txt", "b")
+	txn:commit ()
+
+	local paths = svn.log (url, 2, 2, 0, {changed_paths = "compact"})[2].changed_paths
+	t.equal (#paths, 3, "paths")
+	local tuple = paths[2]
+	t.equal (tuple[1], "A", "action")
+	t.equal (tuple[2], "/branches", "directory")
+	t.equal (tuple[3], "one", "name")
+	assert (tuple[4] == nil or tuple[4] == "dir", "kind")
+	t.equal (tuple[5], "/trunk", "copied from")
+	t.equal (tuple[6], 1, "copied from revision")
+	t.equal (paths[1][3], "branches", "sorted")
+	t.equal (paths[3][2] .. "/" .. paths[3][3], "/trunk/b.txt", "last")
+	assert (paths[3][5] == nil, "not copied")
+
+	local records = svn.log (url, 2, 2, 0, {changed_paths = "table"})[2].changed_paths
+	t.equal (records["/branches/one"].copyfrom_rev, 1, "table")
+	t.raises ("unknown changed paths format", svn.log, url, 2, 2, 0, {changed_paths = "tree"})
+end)
@@ -0,0 +1,55 @@
+-- Tests of copy, move, mkdir and delete given arrays of URLs
+
+local svn = require "svn"
+local t = require "common"
+
+local function components ()
+	return t.repos ({["a/f.txt"] = "a", ["b/f.txt"] = "b", ["c/f.txt"] = "c"})
+end
+
+t.test ("mkdir makes many directories in one revision", function ()
+	local url = components ()
+	t.equal (svn.mkdir ({url .. "/tags", url .. "/branches"}, "layout"), 2, "revision")
+	local list = svn.list (url)
+	assert (list["tags/"] and list["branches/"], "directories")
+	t.equal (svn.log (url, 2, 2)[2].message, "layout", "message")
+end)
+
+t.test ("copy tags many sources in one revision", function ()
+	local url = components ()
+	svn.mkdir (url .. "/tag", "tag")
+	t.equal (svn.copy ({url .. "/a", url .. "/b", url .. "/c"}, url .. "/tag", 1, "tag them"), 3, "revision")
+	t.equal (svn.cat (url .. "/tag/a/f.txt"), "a", "first")
+	t.equal (svn.cat (url .. "/tag/c/f.txt"), "c", "last")
+	t.equal (svn.log (url, 3, 3)[3].message, "tag them", "message")
+end)
+
+t.test ("copy of one source still names the destination", function ()
+	local url = components ()
+	t.equal (svn.copy (url .. "/a", url .. "/d", 1, "copy"), 2, "revision")
+	t.equal (svn.cat (url .. "/d/f.txt"), "a")
+end)
+
+t.test ("move moves many sources in one revision", function ()
+	local url = components ()
+	svn.mkdir (url .. "/old", "old")
+	t.equal (svn.move ({url .. "/a", url .. "/b"}, url .. "/old", "retire"), 3, "revision")
+	t.equal (svn.cat (url .. "/old/b/f.txt"), "b", "moved")
+	t.raises ("", svn.cat, url .. "/a/f.txt")
+	t.equal (svn.cat (url .. "/c/f.txt"), "c", "left alone")
+end)
+
+t.test ("delete removes many paths in one revision", function ()
+	local url = components ()
+	t.equal (svn.delete ({url .. "/a", url .. "/b/f.txt"}, "clean"), 2, "revision")
+	local list = svn.list (url)
+	assert (list["a/"] == nil, "directory")
+	assert (list["b/"] and list["c/"], "left alone")
+	assert (svn.list (url .. "/b")["f.txt"] == nil, "file")
+end)
+
+t.test ("arrays of paths are checked", function ()
+	local url = components ()
+	t.raises ("empty array", svn.mkdir, {}, "nothing")
+	t.raises ("strings", svn.delete, {url .. "/a", {}}, "bad")
+end)
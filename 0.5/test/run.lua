@@ -0,0 +1,46 @@
+-- Runs the tests of the module: lua run.lua [test files]
+-- With no arguments every test file below is run. Run from this
+-- directory, with the module built in the parent one.
+
+package.path = "./?.lua;" .. package.path
+package.cpath = "../?.so;" .. package.cpath
+
+local common = require "common"
+
+-- The interpreter running the tests, for the tests that need another process
+common.lua = arg[-1] or "lua"
+
+local files = {...}
+if #files == 0 then
+	files = {
+		"cat.lua",
+		"iter.lua",
+		"list.lua",
+		"txn.lua",
+		"ops.lua",
+		"wc.lua",
+		"cache.lua",
+		"log.lua",
+		"async.lua",
+		"cancel.lua",
+	}
+end
+
+for _, file in ipairs (files) do
+	dofile (file)
+end
+
+local failed = 0
+for _, t in ipairs (common.tests ()) do
+	local ok, err = pcall (t.func)
+	common.cleanup ()
+	if ok then
+		print ("ok      " .. t.name)
+	else
+		print ("FAILED  " .. t.name .. ": " .. tostring (err))
+		failed = failed + 1
+	end
+end
+
+print (string.format ("%d tests, %d failed", #common.tests (), failed))
+os.exit (failed == 0 and 0 or 1)
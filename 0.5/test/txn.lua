@@ -0,0 +1,58 @@
+-- Tests of svn.txn, commits built without a working copy
+
+local svn = require "svn"
+local t = require "common"
+
+t.test ("a transaction commits all its changes in one revision", function ()
+	local url = t.repos ({["trunk/a.txt"] = "a", ["trunk/b.txt"] = "b"})
+
+	local txn = svn.txn (url, "several changes")
+	txn:put ("trunk/a.txt", "a2")
+	txn:delete ("trunk/b.txt")
+	txn:mkdir ("branches")
+	txn:copy ("trunk", 1, "branches/one")
+	txn:put ("trunk/bin.dat", "\0\1\2")
+	txn:propset ("trunk/bin.dat", "svn:mime-type", "application/octet-stream")
+	t.equal (txn:commit (), 2, "revision")
+
+	t.equal (svn.cat (url .. "/trunk/a.txt"), "a2", "changed file")
+	t.equal (svn.cat (url .. "/trunk/bin.dat"), "\0\1\2", "binary file")
+	t.equal (svn.cat (url .. "/branches/one/b.txt"), "b", "copy")
+	local _, mime = next (svn.propget (url .. "/trunk/bin.dat", "svn:mime-type"))
+	t.equal (mime, "application/octet-stream", "property")
+	t.raises ("", svn.cat, url .. "/trunk/b.txt")
+
+	local log = svn.log (url, 2, 2)
+	t.equal (log[2].message, "several changes", "message")
+end)
+
+t.test ("a transaction on a subdirectory", function ()
+	local url = t.repos ({["trunk/a.txt"] = "a"})
+	local txn = svn.txn (url .. "/trunk")
+	txn:put ("/a.txt", "a2")
+	txn:put ("new/b.txt", "b")
+	txn:mkdir ("new")
+	t.equal (txn:commit (), 2, "revision")
+	t.equal (svn.cat (url .. "/trunk/new/b.txt"), "b")
+end)
+
+t.test ("an empty transaction commits nothing", function ()
+	local url = t.repos ({["a.txt"] = "a"})
+	assert (svn.txn (url):commit () == nil)
+	t.equal (svn.log (url, 1)[2], nil, "revision 2")
+end)
+
+t.test ("a failed transaction changes nothing", function ()
+	local url = t.repos ({["trunk/a.txt"] = "a"})
+	local txn = svn.txn (url)
+	txn:put ("trunk/a.txt", "a2")
+	txn:delete ("trunk/missing.txt")
+	t.raises ("", txn.commit, txn)
+	t.equal (svn.cat (url .. "/trunk/a.txt"), "a")
+
+	txn = svn.txn (url)
+	txn:put ("trunk", "a file over a directory")
+	t.raises ("is a directory", txn.commit, txn)
+
+	t.raises ("root", function () svn.txn (url):put ("", "x") end)
+end)
@@ -0,0 +1,91 @@
+-- Tests of add, commit, update and status on working copies given
+-- arrays of paths
+
+local svn = require "svn"
+local t = require "common"
+
+-- Checks out the repository at URL into a temporary directory
+local function checkout (url, rev)
+	local dir = t.tmpdir () .. "/wc"
+	svn.checkout (url, dir, rev)
+	return dir
+end
+
+local function components ()
+	return t.repos ({["a/f.txt"] = "a", ["b/f.txt"] = "b", ["c/f.txt"] = "c"})
+end
+
+t.test ("add and commit many paths", function ()
+	local url = components ()
+	local wc = checkout (url)
+	t.writefile (wc .. "/a/new.txt", "new a")
+	t.writefile (wc .. "/b/new.txt", "new b")
+	t.writefile (wc .. "/c/f.txt", "c2")
+	svn.add ({wc .. "/a/new.txt", wc .. "/b/new.txt"})
+
+	t.equal (svn.commit ({wc .. "/a", wc .. "/b"}, "some"), 2, "revision")
+	t.equal (svn.cat (url .. "/a/new.txt"), "new a", "first")
+	t.equal (svn.cat (url .. "/b/new.txt"), "new b", "second")
+	t.equal (svn.cat (url .. "/c/f.txt"), "c", "left out")
+end)
+
+t.test ("update gives the revision of each path", function ()
+	local url = components ()
+	local wc = checkout (url)
+	t.commit (url, {["a/f.txt"] = "a2", ["b/f.txt"] = "b2"})
+
+	local revs = svn.update ({wc .. "/a", wc .. "/b"}, 1)
+	t.equal (#revs, 2, "results")
+	t.equal (revs[1], 1, "first")
+	t.equal (revs[2], 1, "second")
+
+	revs = svn.update ({wc .. "/a", wc .. "/c"})
+	t.equal (revs[1], 2, "first")
+	t.equal (revs[2], 2, "second")
+	t.equal (t.readfile (wc .. "/a/f.txt"), "a2", "updated")
+	t.equal (t.readfile (wc .. "/b/f.txt"), "b", "left out")
+
+	t.equal (svn.update (wc .. "/b"), 2, "one path")
+end)
+
+t.test ("status of many paths goes to one table", function ()
+	local url = components ()
+	local wc = checkout (url)
+	t.writefile (wc .. "/a/f.txt", "a2")
+	t.writefile (wc .. "/b/f.txt", "b2")
+	t.writefile (wc .. "/c/f.txt", "c2")
+
+	local status = svn.status ({wc .. "/a", wc .. "/b"})
+	assert (status[wc .. "/a/f.txt"]:match ("^M"), "first")
+	assert (status[wc .. "/b/f.txt"]:match ("^M"), "second")
+	assert (status[wc .. "/c/f.txt"] == nil, "left out")
+end)
+
+t.test ("structured status gives records", function ()
+	local url = components ()
+	local wc = checkout (url)
+	local kinds = svn.status_kinds
+	t.writefile (wc .. "/a/f.txt", "a2")
+	t.writefile (wc .. "/a/new.txt", "new")
+	t.writefile (wc .. "/a/loose.txt", "loose")
+	svn.add (wc .. "/a/new.txt")
+
+	local status = svn.status (wc .. "/a", nil, {structured = true})
+	local modified = status[wc .. "/a/f.txt"]
+	t.equal (modified.text_status, kinds.modified, "modified")
+	t.equal (modified.prop_status, kinds.none, "properties")
+	t.equal (modified.revision, 1, "revision")
+	t.equal (modified.changed_rev, 1, "changed revision")
+	t.equal (modified.copied, false, "copied")
+	t.equal (modified.switched, false, "switched")
+	t.equal (status[wc .. "/a/new.txt"].text_status, kinds.added, "added")
+	t.equal (status[wc .. "/a/loose.txt"].text_status, kinds.unversioned, "unversioned")
+	assert (status[wc .. "/a/loose.txt"].revision == nil, "no entry")
+
+	local seen = 0
+	svn.status_each (wc .. "/a", nil, function (path, record)
+		assert (type (record) == "table", path)
+		seen = seen + 1
+	end, {structured = true})
+	t.equal (seen, 3, "status_each")
+end)